@@ -24,47 +24,947 @@
 
 #pragma once
 
+// RTTI-free builds identify interfaces by DInterfaceId only.
+#if !defined(DQUERYINTERFACE_NO_RTTI) && !defined(__cpp_rtti) && !defined(__GXX_RTTI) && !defined(_CPPRTTI)
+#define DQUERYINTERFACE_NO_RTTI
+#endif
+#if defined(DQUERYINTERFACE_NO_RTTI) && !defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+#define DQUERYINTERFACE_USE_INTERFACE_IDS
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cassert>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <thread>
 #include <tuple>
+#include <type_traits>
+#if !defined(DQUERYINTERFACE_NO_RTTI)
 #include <typeinfo>
+#endif
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#define DQUERYINTERFACE_FUNCTION_SIGNATURE __FUNCSIG__
+#else
+#define DQUERYINTERFACE_FUNCTION_SIGNATURE __PRETTY_FUNCTION__
+#endif
+
+// Compile-time type hash: a 64-bit FNV-1a hash of the compiler-generated signature of DTypeHashOf<T>(), which
+// spells out the qualified name of T. It ignores top-level cv-qualifiers.
+template<typename T>
+constexpr auto DTypeHashOf() noexcept -> uint64_t
+{
+    if constexpr (!std::is_same_v<T, std::remove_cv_t<T>>)
+        return DTypeHashOf<std::remove_cv_t<T>>();
+    else
+    {
+        constexpr auto& signature = DQUERYINTERFACE_FUNCTION_SIGNATURE;
+        auto hash = uint64_t(14695981039346656037ull);
+        for (auto i = size_t(0); i < sizeof(signature) - 1; ++i)
+            hash = (hash ^ static_cast<uint8_t>(signature[i])) * uint64_t(1099511628211ull);
+        return hash;
+    }
+}
+
+// Whether the name of T involves an anonymous namespace. Such names are spelled the same in every translation
+// unit, although they denote distinct types.
+template<typename T>
+constexpr auto DIsInAnonymousNamespace() noexcept -> bool
+{
+    constexpr auto& signature  = DQUERYINTERFACE_FUNCTION_SIGNATURE;
+    constexpr const char* patterns[] = { "(anonymous namespace)", "{anonymous}", "`anonymous namespace'" };
+    for (const char* pattern : patterns)
+        for (auto i = size_t(0); i < sizeof(signature) - 1; ++i)
+        {
+            auto length = size_t(0);
+            while (pattern[length] && (i + length < sizeof(signature) - 1) && (signature[i + length] == pattern[length]))
+                ++length;
+            if (!pattern[length])
+                return true;
+        }
+    return false;
+}
+
+// Compile-time interface identifier, stable across translation units and shared objects. Unlike typeid, it
+// only sees the spelling of the type name, so interfaces declared in anonymous namespaces are rejected: two of
+// them with the same name in different translation units would share an identifier.
+using DInterfaceId = uint64_t;
+
+template<typename T>
+constexpr auto DInterfaceIdOf() noexcept -> DInterfaceId
+{
+    static_assert(!DIsInAnonymousNamespace<T>(), "DInterfaceIdOf: declare interfaces in a named namespace, ids of anonymous namespace types may collide.");
+    return DTypeHashOf<T>();
+}
+
+#if !defined(DQUERYINTERFACE_MAX_INTERFACES)
+#define DQUERYINTERFACE_MAX_INTERFACES 128
+#endif
+
+// Dense interface indices, handed out on first use. Interfaces past DQUERYINTERFACE_MAX_INTERFACES get
+// InvalidIndex and are always resolved through the virtual lookup.
+using DInterfaceMask = std::bitset<DQUERYINTERFACE_MAX_INTERFACES>;
+
+struct DInterfaceIndices final
+{
+    static constexpr size_t InvalidIndex = SIZE_MAX;
+
+    template<typename T> static auto IndexOf() noexcept -> size_t
+    {
+        static const size_t index = Allocate();
+        return index;
+    }
+
+    // Each module (executable or shared library) may hold its own copy of the allocator.
+    static auto GetDomain() noexcept -> const void* { return &s_nextIndex; }
+
+private:
+    static inline std::atomic<size_t> s_nextIndex = 0;
+    static auto Allocate() noexcept -> size_t
+    {
+        const auto index = s_nextIndex.fetch_add(1, std::memory_order_relaxed);
+        return (index < DQUERYINTERFACE_MAX_INTERFACES) ? index : InvalidIndex;
+    }
+};
+
+template<typename T>
+auto DInterfaceIndexOf() noexcept -> size_t { return DInterfaceIndices::IndexOf<std::remove_cv_t<T>>(); }
+
+#if defined(DQUERYINTERFACE_USE_OFFSET_CACHE)
+#if !defined(DQUERYINTERFACE_OFFSET_CACHE_CAPACITY)
+#define DQUERYINTERFACE_OFFSET_CACHE_CAPACITY 1024
+#endif
+
+// Process-wide memo of (dynamic type, interface) -> pointer adjustment. Open addressing with insert-only
+// slots: readers never lock, writers claim an empty slot and publish it with a release store. The interface is
+// identified by its id in ID mode, and by its type_info otherwise: hashed by hash_code() and confirmed by type_info
+// comparison, since ids of types in anonymous namespaces of different translation units may collide.
+struct DInterfaceOffsetCache final
+{
+    static constexpr ptrdiff_t NotImplemented = PTRDIFF_MIN;
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    using DInterface = DInterfaceId;
+#else
+    using DInterface = const std::type_info*;
+#endif
+
+    static auto Find(const void* in_dynamicType, DInterface in_interface, ptrdiff_t* out_offset) noexcept -> bool
+    {
+        for (auto i = size_t(0), slotIndex = HashOf(in_dynamicType, in_interface); i < MaxProbes; ++i, slotIndex = (slotIndex + 1) & (Capacity - 1))
+        {
+            const auto& slot  = s_slots[slotIndex];
+            const auto  state = slot.m_state.load(std::memory_order_acquire);
+            if (state == SlotEmpty)
+                return false;
+            if (state == SlotReady && slot.m_dynamicType == in_dynamicType && IsSameInterface(slot.m_interface, in_interface))
+            {
+                *out_offset = slot.m_offset;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static auto Insert(const void* in_dynamicType, DInterface in_interface, ptrdiff_t in_offset) noexcept -> void
+    {// Lost races may store a key twice, which is harmless. A full probe window just leaves the entry uncached.
+        for (auto i = size_t(0), slotIndex = HashOf(in_dynamicType, in_interface); i < MaxProbes; ++i, slotIndex = (slotIndex + 1) & (Capacity - 1))
+        {
+            auto& slot  = s_slots[slotIndex];
+            auto  state = uint32_t(SlotEmpty);
+            if (slot.m_state.compare_exchange_strong(state, SlotWriting, std::memory_order_acquire))
+            {
+                slot.m_dynamicType = in_dynamicType;
+                slot.m_interface   = in_interface;
+                slot.m_offset      = in_offset;
+                slot.m_state.store(SlotReady, std::memory_order_release);
+                return;
+            }
+            if (state == SlotReady && slot.m_dynamicType == in_dynamicType && IsSameInterface(slot.m_interface, in_interface))
+                return;
+        }
+    }
+
+private:
+    static constexpr size_t Capacity  = DQUERYINTERFACE_OFFSET_CACHE_CAPACITY;
+    static constexpr size_t MaxProbes = 16;
+    static_assert((Capacity & (Capacity - 1)) == 0, "DQUERYINTERFACE_OFFSET_CACHE_CAPACITY must be a power of two.");
+
+    static constexpr uint32_t SlotEmpty = 0, SlotWriting = 1, SlotReady = 2;
+    struct DSlot
+    {
+        std::atomic<uint32_t> m_state;
+        const void*     m_dynamicType;
+        DInterface      m_interface;
+        ptrdiff_t       m_offset;
+    };
+    static inline DSlot s_slots[Capacity] = {};
+
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    static auto KeyOf          (DInterface in_interface)                noexcept -> uint64_t { return in_interface; }
+    static auto IsSameInterface(DInterface in_lhs, DInterface in_rhs) noexcept -> bool     { return in_lhs == in_rhs; }
+#else
+    static auto KeyOf          (DInterface in_interface)                noexcept -> uint64_t { return static_cast<uint64_t>(in_interface->hash_code()); }
+    static auto IsSameInterface(DInterface in_lhs, DInterface in_rhs) noexcept -> bool     { return (in_lhs == in_rhs) || (*in_lhs == *in_rhs); }
+#endif
+    static auto HashOf(const void* in_dynamicType, DInterface in_interface) noexcept -> size_t
+    {
+        const auto hash = (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(in_dynamicType)) ^ KeyOf(in_interface)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(hash >> 32) & (Capacity - 1);
+    }
+};
+#endif
+
 struct DQueryInterface
 {
     enum class EPredicateResult : uint8_t { Ok = 0, CancellationRequested };
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    using DInterfaceKey = DInterfaceId;
+    virtual auto QueryInterfaceById    (DInterfaceId in_interfaceId)          const noexcept -> const void* = 0;
+    virtual auto QueryInterfacesById   (const DInterfaceId* in_interfaceIds, const void** out_interfaces, size_t in_count) const noexcept -> void
+    {
+        for (auto i = size_t(0); i < in_count; ++i)
+            out_interfaces[i] = QueryInterfaceById(in_interfaceIds[i]);
+    }
+#else
+    using DInterfaceKey = const std::type_info&;
     virtual auto QueryInterfaceByTypeId(const std::type_info& in_typeId)  const noexcept -> const void* = 0;
+    virtual auto QueryInterfacesByTypeId(const std::type_info* const* in_typeIds, const void** out_interfaces, size_t in_count) const noexcept -> void
+    {
+        for (auto i = size_t(0); i < in_count; ++i)
+            out_interfaces[i] = QueryInterfaceByTypeId(*in_typeIds[i]);
+    }
+#endif
 
     // Template access.
-    template<typename T> auto QueryInterface() const noexcept -> const T* { return reinterpret_cast<const T*>(QueryInterfaceByTypeId(typeid(T))); }
+#if defined(DQUERYINTERFACE_USE_OFFSET_CACHE)
+    template<typename T> auto QueryInterface() const noexcept -> const T* { return reinterpret_cast<const T*>(QueryInterfaceCached(InterfaceKeyOf<T>())); }
+#else
+    template<typename T> auto QueryInterface() const noexcept -> const T* { return reinterpret_cast<const T*>(QueryInterfaceByKey(InterfaceKeyOf<T>())); }
+#endif
     template<typename T> auto QueryInterface() noexcept       -> T*       { return const_cast<T*>(static_cast<const DQueryInterface&>(*this).QueryInterface<T>()); }
-    template<typename T> auto HasInterface  () const noexcept -> bool     { return QueryInterface<T>() != nullptr; }
+    template<typename T> auto HasInterface  () const noexcept -> bool
+    {
+        const auto index = DInterfaceIndexOf<T>();
+        if (m_classInfo && (index != DInterfaceIndices::InvalidIndex) && (m_classInfo->m_indexDomain == DInterfaceIndices::GetDomain()))
+            return m_classInfo->m_interfaceMask.test(index);
+        return QueryInterface<T>() != nullptr;
+    }
+
+    // Batched template access: resolves every interface with a single virtual call. Missing ones are null.
+    template<typename... TINTERFACES> auto QueryInterfaces() const noexcept -> std::tuple<const TINTERFACES*...>
+    {
+        static_assert(sizeof...(TINTERFACES) > 0, "QueryInterfaces requires at least one interface.");
+        const void* found[sizeof...(TINTERFACES)] = {};
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+        static constexpr DInterfaceId interfaceIds[] = { DInterfaceIdOf<TINTERFACES>()... };
+        QueryInterfacesById(interfaceIds, found, sizeof...(TINTERFACES));
+#else
+        const std::type_info* const typeIds[] = { &typeid(TINTERFACES)... };
+        QueryInterfacesByTypeId(typeIds, found, sizeof...(TINTERFACES));
+#endif
+        return UnpackInterfaces<const TINTERFACES...>(found, std::index_sequence_for<TINTERFACES...>());
+    }
+    template<typename... TINTERFACES> auto QueryInterfaces() noexcept -> std::tuple<TINTERFACES*...>
+    {
+        const auto found = static_cast<const DQueryInterface&>(*this).QueryInterfaces<TINTERFACES...>();
+        return std::apply([](const TINTERFACES*... in_interfaces) { return std::tuple<TINTERFACES*...>(const_cast<TINTERFACES*>(in_interfaces)...); }, found);
+    }
 
     // COM-like access.
-    auto QueryInterface(const std::type_info& in_typeId, const void** out_interface) const noexcept -> bool { return (*out_interface = QueryInterfaceByTypeId(in_typeId)); }
-    auto QueryInterface(const std::type_info& in_typeId,       void** out_interface)       noexcept -> bool { return (*out_interface = const_cast<void*>(QueryInterfaceByTypeId(in_typeId))); }
+    auto QueryInterface(DInterfaceKey in_interfaceKey, const void** out_interface) const noexcept -> bool { return (*out_interface = QueryInterfaceByKey(in_interfaceKey)); }
+    auto QueryInterface(DInterfaceKey in_interfaceKey,       void** out_interface)       noexcept -> bool { return (*out_interface = const_cast<void*>(QueryInterfaceByKey(in_interfaceKey))); }
 
     // Runtime  access.
-    auto QueryInterface(const std::type_info& in_typeId) const noexcept -> const void* { return QueryInterfaceByTypeId(in_typeId); }
-    auto QueryInterface(const std::type_info& in_typeId)       noexcept -> void*       { return const_cast<void*>(QueryInterfaceByTypeId(in_typeId)); }
-    auto HasInterface  (const std::type_info& in_typeId) const noexcept -> bool        { return QueryInterfaceByTypeId(in_typeId) != nullptr; }
+    auto QueryInterface(DInterfaceKey in_interfaceKey) const noexcept -> const void* { return QueryInterfaceByKey(in_interfaceKey); }
+    auto QueryInterface(DInterfaceKey in_interfaceKey)       noexcept -> void*       { return const_cast<void*>(QueryInterfaceByKey(in_interfaceKey)); }
+    auto HasInterface  (DInterfaceKey in_interfaceKey) const noexcept -> bool        { return QueryInterfaceByKey(in_interfaceKey) != nullptr; }
+
+    // Per-class data shared by all the instances of a class, when the class provides it (see DImplements).
+    struct DClassInfo
+    {
+        DInterfaceMask  m_interfaceMask;
+        const void*     m_indexDomain = nullptr;
+    };
+    auto GetClassInfo() const noexcept -> const DClassInfo* { return m_classInfo; }
+
+    // Opaque identity of the dynamic type, shared by all the instances of a class. The vtable pointer identifies
+    // it without RTTI.
+    auto GetDynamicType() const noexcept -> const void*
+    {
+        const void* dynamicType = nullptr;
+        std::memcpy(&dynamicType, this, sizeof(dynamicType));
+        return dynamicType;
+    }
+
+    // Interface keys.
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    template<typename T> static constexpr auto InterfaceKeyOf() noexcept -> DInterfaceKey { return std::integral_constant<DInterfaceId, DInterfaceIdOf<T>()>::value; }
+#else
+    template<typename T> static           auto InterfaceKeyOf() noexcept -> DInterfaceKey { return typeid(T); }
+#endif
+
+protected:
+    const DClassInfo* m_classInfo = nullptr;
+
+private:
+    template<typename... TINTERFACES, size_t... INDICES>
+    static auto UnpackInterfaces(const void* const* in_interfaces, std::index_sequence<INDICES...>) noexcept -> std::tuple<TINTERFACES*...>
+    {
+        return std::tuple<TINTERFACES*...>(reinterpret_cast<TINTERFACES*>(in_interfaces[INDICES])...);
+    }
+
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    auto QueryInterfaceByKey(DInterfaceKey in_interfaceKey) const noexcept -> const void* { return QueryInterfaceById    (in_interfaceKey); }
+#else
+    auto QueryInterfaceByKey(DInterfaceKey in_interfaceKey) const noexcept -> const void* { return QueryInterfaceByTypeId(in_interfaceKey); }
+#endif
+
+#if defined(DQUERYINTERFACE_USE_OFFSET_CACHE)
+    auto QueryInterfaceCached(DInterfaceKey in_interfaceKey) const noexcept -> const void*
+    {
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+        const auto cacheKey    = in_interfaceKey;
+#else
+        const auto cacheKey    = &in_interfaceKey;
+#endif
+        const auto dynamicType = GetDynamicType();
+        auto offset = ptrdiff_t(0);
+        if (DInterfaceOffsetCache::Find(dynamicType, cacheKey, &offset))
+            return (offset != DInterfaceOffsetCache::NotImplemented) ? reinterpret_cast<const char*>(this) + offset : nullptr;
+        const void* found = QueryInterfaceByKey(in_interfaceKey);
+        DInterfaceOffsetCache::Insert(dynamicType, cacheKey, found ? reinterpret_cast<const char*>(found) - reinterpret_cast<const char*>(this) : DInterfaceOffsetCache::NotImplemented);
+        return found;
+    }
+#endif
 };
 
+// Implements DQueryInterface for TSELF from the list of interfaces it derives from. The lookup uses a table of
+// (key, this-adjustment) pairs sorted by key and built once per class. The key is the interface id in ID mode, and
+// type_info::hash_code() otherwise, with matches confirmed by type_info comparison.
+template<typename TSELF, typename... TINTERFACES>
+struct DImplements
+    : DQueryInterface
+    , TINTERFACES...
+{
+    static_assert(sizeof...(TINTERFACES) > 0, "DImplements requires at least one interface.");
+
+    DImplements() noexcept { m_classInfo = &GetImplementsClassInfo(); }
+
+    using DImplementsSelf = TSELF;
+
+    // Class info shared by the instances of TSELF and of the classes deriving from it.
+    static auto GetImplementsClassInfo() noexcept -> const DClassInfo&
+    {
+        static const DClassInfo classInfo = []()
+        {
+            auto result = DClassInfo{};
+            for (const auto index : { DInterfaceIndexOf<TINTERFACES>()... })
+                if (index != DInterfaceIndices::InvalidIndex)
+                    result.m_interfaceMask.set(index);
+            result.m_indexDomain = DInterfaceIndices::GetDomain();
+            return result;
+        }();
+        return classInfo;
+    }
+
+
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    auto QueryInterfaceById(DInterfaceId in_interfaceId) const noexcept -> const void* final
+    {
+        return FindInterface(GetInterfaceTable(), in_interfaceId);
+    }
+
+    auto QueryInterfacesById(const DInterfaceId* in_interfaceIds, const void** out_interfaces, size_t in_count) const noexcept -> void final
+    {
+        const auto& table = GetInterfaceTable();
+        for (auto i = size_t(0); i < in_count; ++i)
+            out_interfaces[i] = FindInterface(table, in_interfaceIds[i]);
+    }
+#else
+    auto QueryInterfaceByTypeId(const std::type_info& in_typeId) const noexcept -> const void* final
+    {
+        return FindInterface(GetInterfaceTable(), in_typeId);
+    }
+
+    auto QueryInterfacesByTypeId(const std::type_info* const* in_typeIds, const void** out_interfaces, size_t in_count) const noexcept -> void final
+    {
+        const auto& table = GetInterfaceTable();
+        for (auto i = size_t(0); i < in_count; ++i)
+            out_interfaces[i] = FindInterface(table, *in_typeIds[i]);
+    }
+#endif
+
+private:
+    static constexpr size_t LinearSearchThreshold = 8;
+    struct DInterfaceEntry
+    {
+        uint64_t                m_sortKey;
+#if !defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+        const std::type_info*   m_typeId; // Hash codes may collide.
+#endif
+        ptrdiff_t               m_offset;
+    };
+    using DInterfaceTable = std::array<DInterfaceEntry, sizeof...(TINTERFACES)>;
+
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    template<typename TINTERFACE>
+    static auto MakeEntry(ptrdiff_t in_offset) noexcept -> DInterfaceEntry { return { DInterfaceIdOf<TINTERFACE>(), in_offset }; }
+    static auto SortKeyOf(DInterfaceId in_interfaceId) noexcept -> uint64_t { return in_interfaceId; }
+    static auto IsEntryOf(const DInterfaceEntry& in_entry, DInterfaceId in_interfaceId) noexcept -> bool { return in_entry.m_sortKey == in_interfaceId; }
+#else
+    template<typename TINTERFACE>
+    static auto MakeEntry(ptrdiff_t in_offset) noexcept -> DInterfaceEntry { return { typeid(TINTERFACE).hash_code(), &typeid(TINTERFACE), in_offset }; }
+    static auto SortKeyOf(const std::type_info& in_typeId) noexcept -> uint64_t { return in_typeId.hash_code(); }
+    static auto IsEntryOf(const DInterfaceEntry& in_entry, const std::type_info& in_typeId) noexcept -> bool { return *in_entry.m_typeId == in_typeId; }
+#endif
+
+    template<typename TKEY>
+    auto FindInterface(const DInterfaceTable& in_table, const TKEY& in_key) const noexcept -> const void*
+    {
+        const DInterfaceEntry* found = nullptr;
+        if constexpr (sizeof...(TINTERFACES) <= LinearSearchThreshold)
+        {// Few entries: a short scan beats the branches of a binary search.
+            for (const auto& it : in_table)
+                if (IsEntryOf(it, in_key))
+                    found = &it;
+        }
+        else
+        {
+            const auto sortKey = SortKeyOf(in_key);
+            auto it = std::lower_bound(in_table.begin(), in_table.end(), sortKey, [](const DInterfaceEntry& in_entry, uint64_t in_sortKey) { return in_entry.m_sortKey < in_sortKey; });
+            for (; (it != in_table.end()) && (it->m_sortKey == sortKey); ++it)
+                if (IsEntryOf(*it, in_key))
+                {
+                    found = &*it;
+                    break;
+                }
+        }
+        return found ? reinterpret_cast<const char*>(this) + found->m_offset : nullptr;
+    }
+
+    auto GetInterfaceTable() const noexcept -> const DInterfaceTable&
+    {// Offsets do not depend on the instance, so the first one to be queried builds the table for all of them.
+        static const DInterfaceTable table = [this]()
+        {
+            const auto* base = reinterpret_cast<const char*>(this);
+            auto result = DInterfaceTable{ MakeEntry<TINTERFACES>(reinterpret_cast<const char*>(static_cast<const TINTERFACES*>(this)) - base)... };
+            std::sort(result.begin(), result.end(), [](const DInterfaceEntry& in_lhs, const DInterfaceEntry& in_rhs) { return in_lhs.m_sortKey < in_rhs.m_sortKey; });
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+            assert(std::adjacent_find(result.begin(), result.end(), [](const DInterfaceEntry& in_lhs, const DInterfaceEntry& in_rhs) { return in_lhs.m_sortKey == in_rhs.m_sortKey; }) == result.end());
+#endif
+            return result;
+        }();
+        return table;
+    }
+};
+
+// Lock-free multi-producer, single-consumer queue. Producers push with a CAS on the head and never wait on each
+// other nor on the consumer, which detaches the whole list at once and consumes it in push order.
+template<typename T>
+struct DMpscQueue final
+{
+    DMpscQueue() = default;
+   ~DMpscQueue() { Drain([](T&&) { ; }); }
+
+    auto Push(T in_value) noexcept -> void
+    {
+        auto* node = new DNode{ std::move(in_value), m_head.load(std::memory_order_relaxed) };
+        while (!m_head.compare_exchange_weak(node->m_next, node, std::memory_order_release, std::memory_order_relaxed)) { ; }
+    }
+
+    // Links the nodes of a whole range first, then publishes them with a single CAS, in range order. Elements are
+    // copied, or moved through move iterators. Returns the number of elements pushed.
+    template<typename TITERATOR>
+    auto PushRange(TITERATOR in_first, TITERATOR in_last) noexcept -> size_t
+    {
+        DNode* first = nullptr;
+        DNode* last  = nullptr;
+        auto count   = size_t(0);
+        for (; in_first != in_last; ++in_first)
+        {// Newest first, as if pushed one by one.
+            first = new DNode{ T(*in_first), first };
+            last  = last ? last : first;
+            ++count;
+        }
+        if (!first)
+            return 0;
+        last->m_next = m_head.load(std::memory_order_relaxed);
+        while (!m_head.compare_exchange_weak(last->m_next, first, std::memory_order_release, std::memory_order_relaxed)) { ; }
+        return count;
+    }
+
+    auto IsEmpty() const noexcept -> bool { return m_head.load(std::memory_order_acquire) == nullptr; }
+
+    // Must not be called concurrently with itself.
+    template<typename TCONSUMERFN>
+    auto Drain(TCONSUMERFN&& in_consumerFn) noexcept -> void
+    {
+        DNode* node = m_head.exchange(nullptr, std::memory_order_acquire);
+        DNode* ordered = nullptr;
+        while (node)
+        {// Reverse the LIFO chain into push order.
+            auto* next = node->m_next;
+            node->m_next = ordered;
+            ordered = node;
+            node = next;
+        }
+        while (ordered)
+        {
+            auto* next = ordered->m_next;
+            in_consumerFn(std::move(ordered->m_value));
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+private:
+    struct DNode { T m_value; DNode* m_next; };
+    std::atomic<DNode*> m_head = nullptr;
+    DMpscQueue (const DMpscQueue&)          = delete;
+    DMpscQueue&operator=(const DMpscQueue&) = delete;
+};
+
+// Minimal persistent thread pool for DInterfaceCollection::ForEachParallel(). Any type providing GetConcurrency() and
+// Execute(taskCount, taskFn) can be used instead: Execute() must call taskFn(taskIndex) once per task, possibly
+// concurrently, and return when all of them have finished. Tasks may call Execute() on the same executor again: the
+// nested job runs inline on the calling thread. Jobs from unrelated threads run one after the other.
+struct DThreadPoolExecutor final
+{
+    explicit DThreadPoolExecutor(unsigned int in_workerCount = std::max(1u, std::thread::hardware_concurrency()) - 1)
+    {
+        for (auto i = 0u; i < in_workerCount; ++i)
+            m_workers.emplace_back([this]() { RunWorker(); });
+    }
+
+   ~DThreadPoolExecutor()
+    {
+        {
+            auto&& _ = std::scoped_lock(m_lock);
+            m_stopRequested = true;
+        }
+        m_wakeUp.notify_all();
+        for (auto& it : m_workers)
+            it.join();
+    }
+
+    // Worker threads plus the calling thread, which also runs tasks.
+    auto GetConcurrency() const noexcept -> size_t { return m_workers.size() + 1; }
+
+    template<typename TTASKFN>
+    auto Execute(size_t in_taskCount, TTASKFN&& in_taskFn) noexcept -> void
+    {
+        if (s_currentExecutor == this)
+        {// Nested in one of our tasks: the workers may all be busy with the outer job.
+            for (auto i = size_t(0); i < in_taskCount; ++i)
+                in_taskFn(i);
+            return;
+        }
+        auto&& _ = std::scoped_lock(m_executeLock);
+        auto*  outerExecutor = std::exchange(s_currentExecutor, this);
+        {
+            auto&& __ = std::scoped_lock(m_lock);
+            m_taskFn        = [](void* in_context, size_t in_taskIndex) { (*static_cast<std::remove_reference_t<TTASKFN>*>(in_context))(in_taskIndex); };
+            m_taskContext   = &in_taskFn;
+            m_taskCount     = in_taskCount;
+            m_nextTask      = 0;
+            ++m_jobId;
+        }
+        m_wakeUp.notify_all();
+        RunTasks();
+        auto&& lock = std::unique_lock(m_lock);
+        m_jobDone.wait(lock, [this]() { return (m_finishedTasks == m_taskCount) && (m_activeWorkers == 0); });
+        m_finishedTasks = 0;
+        m_taskCount     = 0;
+        s_currentExecutor = outerExecutor;
+    }
+
+private:
+    std::vector<std::thread>    m_workers;
+    std::mutex                  m_lock, m_executeLock;
+    std::condition_variable     m_wakeUp, m_jobDone;
+    void                      (*m_taskFn)(void*, size_t) = nullptr;
+    void*                       m_taskContext   = nullptr;
+    size_t                      m_taskCount     = 0, m_nextTask = 0, m_finishedTasks = 0, m_jobId = 0;
+    unsigned int                m_activeWorkers = 0;
+    bool                        m_stopRequested = false;
+    static inline thread_local const DThreadPoolExecutor* s_currentExecutor = nullptr; // Executor whose tasks the thread is running.
+    DThreadPoolExecutor (const DThreadPoolExecutor&)          = delete;
+    DThreadPoolExecutor&operator=(const DThreadPoolExecutor&) = delete;
+
+    auto RunTasks() noexcept -> void
+    {
+        auto&& lock = std::unique_lock(m_lock);
+        while (m_nextTask < m_taskCount)
+        {
+            const auto taskIndex = m_nextTask++;
+            lock.unlock();
+            m_taskFn(m_taskContext, taskIndex);
+            lock.lock();
+            ++m_finishedTasks;
+        }
+        if (m_finishedTasks == m_taskCount)
+            m_jobDone.notify_all();
+    }
+
+    auto RunWorker() noexcept -> void
+    {
+        s_currentExecutor = this;
+        auto lastJobId = size_t(0);
+        for (;;)
+        {
+            {
+                auto&& lock = std::unique_lock(m_lock);
+                m_wakeUp.wait(lock, [&]() { return m_stopRequested || (m_jobId != lastJobId); });
+                if (m_stopRequested)
+                    return;
+                lastJobId = m_jobId;
+                ++m_activeWorkers;
+            }
+            RunTasks();
+            {
+                auto&& _ = std::scoped_lock(m_lock);
+                --m_activeWorkers;
+            }
+            m_jobDone.notify_all();
+        }
+    }
+};
+
+// Number of add/remove records the registry keeps so collections can catch up incrementally. Collections lagging
+// further behind rebuild from scratch.
+#if !defined(DQUERYINTERFACE_CHANGE_LOG_CAPACITY)
+#define DQUERYINTERFACE_CHANGE_LOG_CAPACITY 4096
+#endif
+
+// Non-owning view over contiguous elements, standing in for std::span (C++20). Lowercase members keep it usable
+// with range-based for and the standard algorithms.
+template<typename T>
+struct DSpan final
+{
+    constexpr DSpan() noexcept = default;
+    constexpr DSpan(T* in_data, size_t in_size) noexcept : m_data(in_data), m_size(in_size) { ; }
+
+    constexpr auto begin() const noexcept -> T*     { return m_data; }
+    constexpr auto end  () const noexcept -> T*     { return m_data + m_size; }
+    constexpr auto data () const noexcept -> T*     { return m_data; }
+    constexpr auto size () const noexcept -> size_t { return m_size; }
+    constexpr auto empty() const noexcept -> bool   { return m_size == 0; }
+    constexpr auto operator[](size_t in_index) const noexcept -> T& { assert(in_index < m_size); return m_data[in_index]; }
+
+private:
+    T*      m_data = nullptr;
+    size_t  m_size = 0;
+};
+
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+// Generational reference to a registered object. Handles of removed objects stop resolving, even when their slot
+// is reused by a newer object.
+struct DObjectHandle final
+{
+    static constexpr uint32_t InvalidIndex = UINT32_MAX;
+
+    uint32_t m_index      = InvalidIndex;
+    uint32_t m_generation = 0;
+
+    explicit operator bool() const noexcept { return m_index != InvalidIndex; }
+    auto operator==(const DObjectHandle& in_other) const noexcept -> bool { return (m_index == in_other.m_index) && (m_generation == in_other.m_generation); }
+    auto operator!=(const DObjectHandle& in_other) const noexcept -> bool { return !(*this == in_other); }
+};
+#endif
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+#error "DQUERYINTERFACE_USE_WEAK_REFERENCES and DQUERYINTERFACE_USE_OBJECT_HANDLES are exclusive: handles rely on the registry owning the objects."
+#endif
+// Non-owning registry entry. The pointer and class info outlive the object, so an expired entry can still be
+// looked up and purged.
+struct DWeakObject final
+{
+    std::weak_ptr<DQueryInterface>      m_object;
+    DQueryInterface*                    m_pointer;
+    const DQueryInterface::DClassInfo*  m_classInfo;
+};
+#endif
+
+// Fixed-size block pool backing DObjectRegistry::Emplace(), for one class. The first allocation sets the block
+// size: all the allocations of a pool come from the same allocate_shared() type. Blocks are carved from chunks of
+// growing size, so objects allocated together end up next to each other. The registry creates its pools and
+// releases them when destroyed; a released pool deletes itself once its last block is freed. Classes named alike
+// in anonymous namespaces may share a pool, which only serves the allocations matching its block size.
+template<typename TMUTEXTYPE>
+struct DObjectPool final
+{
+    explicit DObjectPool(uint64_t in_classId) noexcept : m_classId(in_classId) { ; }
+
+    auto GetClassId() const noexcept -> uint64_t { return m_classId; }
+
+    // Returns null if the pool serves another block size. Throws std::bad_alloc if a new chunk cannot be allocated.
+    auto Allocate(size_t in_size, size_t in_alignment) -> void*
+    {
+        auto&& _ = std::scoped_lock(m_lock);
+        if (m_blockSize == 0)
+        {
+            m_blockAlignment = std::max(in_alignment, alignof(DFreeBlock));
+            m_blockSize      = (std::max(in_size, sizeof(DFreeBlock)) + m_blockAlignment - 1) / m_blockAlignment * m_blockAlignment;
+            m_objectSize     = in_size;
+        }
+        if ((in_size != m_objectSize) || (in_alignment > m_blockAlignment))
+            return nullptr;
+        if (!m_freeBlocks)
+            AllocateChunk();
+        auto* block  = m_freeBlocks;
+        m_freeBlocks = block->m_next;
+        ++m_liveBlocks;
+        return block;
+    }
+
+    // Returns false if the block does not belong to the pool.
+    auto Deallocate(void* in_block, size_t in_size, size_t in_alignment) noexcept -> bool
+    {
+        bool destroy = false;
+        {
+            auto&& _ = std::scoped_lock(m_lock);
+            if ((m_blockSize == 0) || (in_size != m_objectSize) || (in_alignment > m_blockAlignment))
+                return false;
+            m_freeBlocks = new (in_block) DFreeBlock{ m_freeBlocks };
+            destroy = (--m_liveBlocks == 0) && m_released;
+        }
+        if (destroy)
+            delete this;
+        return true;
+    }
+
+    // Called by the owning registry instead of deleting the pool.
+    auto Release() noexcept -> void
+    {
+        bool destroy = false;
+        {
+            auto&& _ = std::scoped_lock(m_lock);
+            m_released = true;
+            destroy    = (m_liveBlocks == 0);
+        }
+        if (destroy)
+            delete this;
+    }
+
+private:
+    static constexpr size_t MinBlocksPerChunk = 16, MaxBlocksPerChunk = 1024;
+    struct DFreeBlock { DFreeBlock* m_next; };
+    std::vector<void*>  m_chunks;
+    DFreeBlock*         m_freeBlocks     = nullptr;
+    size_t              m_blockSize      = 0, m_blockAlignment = 0, m_objectSize = 0;
+    size_t              m_blocksPerChunk = MinBlocksPerChunk;
+    size_t              m_liveBlocks     = 0; // Guarded by m_lock, so objects do not share a reference count.
+    bool                m_released       = false;
+    const uint64_t      m_classId;
+    TMUTEXTYPE          m_lock;
+    DObjectPool (const DObjectPool&)          = delete;
+    DObjectPool&operator=(const DObjectPool&) = delete;
+   ~DObjectPool()
+    {
+        for (auto& it : m_chunks)
+            ::operator delete(it, std::align_val_t(m_blockAlignment));
+    }
+
+    auto AllocateChunk() -> void
+    {// Requires m_lock. Blocks are linked in address order, so consecutive allocations are adjacent.
+        m_chunks.reserve(m_chunks.size() + 1);
+        auto* chunk = static_cast<char*>(::operator new(m_blockSize * m_blocksPerChunk, std::align_val_t(m_blockAlignment)));
+        m_chunks.push_back(chunk);
+        for (auto i = m_blocksPerChunk; i-- > 0;)
+            m_freeBlocks = new (chunk + i * m_blockSize) DFreeBlock{ m_freeBlocks };
+        m_blocksPerChunk = std::min(m_blocksPerChunk * 2, MaxBlocksPerChunk);
+    }
+};
+
+// Dense per-class indices of the registries' pool slots, handed out on first Emplace(). Each module (executable or
+// shared library) may hold its own copy of the counter, so slots are checked against the class id.
+#if !defined(DQUERYINTERFACE_MAX_POOLED_CLASSES)
+#define DQUERYINTERFACE_MAX_POOLED_CLASSES 256
+#endif
+struct DPoolIndices final
+{
+    template<typename T> static auto IndexOf() noexcept -> size_t
+    {
+        static const size_t index = s_nextIndex.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+private:
+    static inline std::atomic<size_t> s_nextIndex = 0;
+};
+
+// Allocator drawing single objects from a DObjectPool, and anything else from the heap. The pool counts its live
+// blocks itself, so it outlives the registry as long as objects allocated from it are alive.
+template<typename T, typename TPOOL>
+struct DPoolAllocator final
+{
+    using value_type = T;
+
+    explicit DPoolAllocator(TPOOL* in_pool) noexcept : m_pool(in_pool) { ; }
+    template<typename U> DPoolAllocator(const DPoolAllocator<U, TPOOL>& in_other) noexcept : m_pool(in_other.m_pool) { ; }
+
+    auto allocate(size_t in_count) -> T*
+    {
+        if (void* block = (in_count == 1) ? m_pool->Allocate(sizeof(T), alignof(T)) : nullptr)
+            return static_cast<T*>(block);
+        return static_cast<T*>(::operator new(in_count * sizeof(T), std::align_val_t(alignof(T))));
+    }
+
+    auto deallocate(T* in_pointer, size_t in_count) noexcept -> void
+    {
+        if ((in_count != 1) || !m_pool->Deallocate(in_pointer, sizeof(T), alignof(T)))
+            ::operator delete(in_pointer, std::align_val_t(alignof(T)));
+    }
+
+    template<typename U> auto operator==(const DPoolAllocator<U, TPOOL>& in_other) const noexcept -> bool { return m_pool == in_other.m_pool; }
+    template<typename U> auto operator!=(const DPoolAllocator<U, TPOOL>& in_other) const noexcept -> bool { return m_pool != in_other.m_pool; }
+
+private:
+    template<typename, typename> friend struct DPoolAllocator;
+    TPOOL* m_pool;
+};
+
+// Mutex types exposing lock_shared() (std::shared_mutex, SRWLock wrappers...) let readers run concurrently.
+template<typename TMUTEXTYPE, typename = void>
+struct DIsSharedMutex : std::false_type { };
+template<typename TMUTEXTYPE>
+struct DIsSharedMutex<TMUTEXTYPE, std::void_t<decltype(std::declval<TMUTEXTYPE&>().lock_shared()), decltype(std::declval<TMUTEXTYPE&>().unlock_shared())>> : std::true_type { };
+
+// Containers owning their elements, told apart from views (DSpan...) by their allocator. Only the former are moved
+// from when passed as rvalues to the bulk requests.
+template<typename TRANGE, typename = void>
+struct DIsOwningRange : std::false_type { };
+template<typename TRANGE>
+struct DIsOwningRange<TRANGE, std::void_t<typename TRANGE::allocator_type>> : std::true_type { };
+
+// Interface collection query terms. Plain interfaces given to CreateInterfaceCollection() are required, as if
+// listed in DAll<>. Predicates receive the required interfaces by reference, then the optional ones as pointers
+// (null when not implemented).
+template<typename... TINTERFACES> struct DAll      final { };
+template<typename... TINTERFACES> struct DNone     final { };
+template<typename... TINTERFACES> struct DOptional final { };
+
+template<typename TREQUIRED, typename TEXCLUDED, typename TOPTIONAL>
+struct DInterfaceQueryTerms;
+
+template<typename... TREQUIRED, typename... TEXCLUDED, typename... TOPTIONAL>
+struct DInterfaceQueryTerms<DAll<TREQUIRED...>, DNone<TEXCLUDED...>, DOptional<TOPTIONAL...>> final
+{
+    static constexpr size_t RequiredCount = sizeof...(TREQUIRED);
+    using DRequired = DAll<TREQUIRED...>;
+    using DArrays   = std::tuple<std::vector<TREQUIRED*>..., std::vector<TOPTIONAL*>...>; // Resolved pointers, one array per term.
+
+    template<typename TTERM> struct DAdd                    { using Type = DInterfaceQueryTerms<DAll<TREQUIRED..., TTERM>, DNone<TEXCLUDED...>, DOptional<TOPTIONAL...>>; };
+    template<typename... TI> struct DAdd<DAll     <TI...>>  { using Type = DInterfaceQueryTerms<DAll<TREQUIRED..., TI...>, DNone<TEXCLUDED...>, DOptional<TOPTIONAL...>>; };
+    template<typename... TI> struct DAdd<DNone    <TI...>>  { using Type = DInterfaceQueryTerms<DAll<TREQUIRED...>, DNone<TEXCLUDED..., TI...>, DOptional<TOPTIONAL...>>; };
+    template<typename... TI> struct DAdd<DOptional<TI...>>  { using Type = DInterfaceQueryTerms<DAll<TREQUIRED...>, DNone<TEXCLUDED...>, DOptional<TOPTIONAL..., TI...>>; };
+
+    template<typename TPREDICATEFN>
+    static constexpr bool IsInvocable = std::is_invocable_r_v<DQueryInterface::EPredicateResult, TPREDICATEFN&, TREQUIRED&..., TOPTIONAL*...>;
+    template<typename TCHUNKFN>
+    static constexpr bool IsChunkInvocable = std::is_invocable_r_v<DQueryInterface::EPredicateResult, TCHUNKFN&, DSpan<TREQUIRED* const>..., DSpan<TOPTIONAL* const>...>;
+
+    static auto Matches(const DQueryInterface& in_object) noexcept -> bool { return (in_object.HasInterface<TREQUIRED>() && ...) && !(in_object.HasInterface<TEXCLUDED>() || ...); }
+    static auto Resolve(DQueryInterface& in_object) noexcept { return in_object.QueryInterfaces<TREQUIRED..., TOPTIONAL...>(); }
+
+    template<typename TPREDICATEFN>
+    static auto Invoke(TPREDICATEFN& in_predicateFn, DArrays& in_arrays, size_t in_index) noexcept -> DQueryInterface::EPredicateResult
+    {
+        return InvokeAt(in_predicateFn, in_arrays, in_index, std::index_sequence_for<TREQUIRED..., TOPTIONAL...>());
+    }
+
+    template<typename TCHUNKFN>
+    static auto InvokeChunk(TCHUNKFN& in_chunkFn, DArrays& in_arrays, size_t in_index, size_t in_count) noexcept -> DQueryInterface::EPredicateResult
+    {
+        return std::apply([=, &in_chunkFn](auto&... in_interfaces) -> DQueryInterface::EPredicateResult
+        {
+            return in_chunkFn(DSpan<typename std::remove_reference_t<decltype(in_interfaces)>::value_type const>(in_interfaces.data() + in_index, in_count)...);
+        }, in_arrays);
+    }
+
+private:
+    template<typename TPREDICATEFN, size_t... TINDICES>
+    static auto InvokeAt(TPREDICATEFN& in_predicateFn, DArrays& in_arrays, size_t in_index, std::index_sequence<TINDICES...>) noexcept -> DQueryInterface::EPredicateResult
+    {
+        return in_predicateFn(Argument<TINDICES>(std::get<TINDICES>(in_arrays)[in_index])...);
+    }
+
+    template<size_t TINDEX, typename T>
+    static auto Argument(T* in_interface) noexcept -> decltype(auto)
+    {
+        if constexpr (TINDEX < RequiredCount)
+            return (*in_interface);
+        else
+            return in_interface;
+    }
+};
+
+// Element order of an interface collection. GroupedByType keeps objects of the same dynamic type contiguous, so
+// consecutive virtual calls go to the same implementation.
+enum class ECollectionOrder
+{
+    Unordered,
+    GroupedByType,
+};
+
+template<typename TQUERY, typename... TTERMS>
+struct DBuildInterfaceQuery { using Type = TQUERY; };
+template<typename TQUERY, typename TTERM, typename... TTERMS>
+struct DBuildInterfaceQuery<TQUERY, TTERM, TTERMS...> : DBuildInterfaceQuery<typename TQUERY::template DAdd<TTERM>::Type, TTERMS...> { };
+
+template<typename... TTERMS>
+using DInterfaceQuery = typename DBuildInterfaceQuery<DInterfaceQueryTerms<DAll<>, DNone<>, DOptional<>>, TTERMS...>::Type;
+
 template<typename TMUTEXTYPE = std::mutex>
 struct DObjectRegistry final
 {
     DObjectRegistry() = default;
-   ~DObjectRegistry() = default;
+   ~DObjectRegistry()
+    {// Pools still serving objects delete themselves once the last one is freed.
+        for (auto& it : m_objectPools)
+            if (it.second)
+                it.second->Release();
+    }
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    using DObjectReference = DWeakObject; // Objects stay registered until they expire or are removed.
+#else
+    using DObjectReference = std::shared_ptr<DQueryInterface>;
+#endif
 
-    template<typename TINTERFACE> struct DInterfaceCollection;
-    template<typename TINTERFACE> auto CreateInterfaceCollection()    noexcept -> DInterfaceCollection<TINTERFACE> { return DInterfaceCollection<TINTERFACE>(*this); }
+    // Collections cache the objects matching the given interfaces and query terms (see DAll, DNone, DOptional).
+    template<typename... TTERMS> struct DInterfaceCollection;
+    template<typename... TTERMS> auto CreateInterfaceCollection(ECollectionOrder in_order = ECollectionOrder::Unordered) noexcept -> DInterfaceCollection<TTERMS...> { return DInterfaceCollection<TTERMS...>(*this, in_order); }
     auto RequestAddObject(std::shared_ptr<DQueryInterface> in_object) noexcept -> void
     {
-        assert(in_object); 
-        auto&& _ = std::scoped_lock(m_objectsToAddLock); 
-        m_objectsToAdd.push_back(in_object); 
+        assert(in_object);
+        m_objectsToAdd.Push(std::move(in_object));
+    }
+
+    // Constructs a T in the registry's pool for its class and requests its addition. Objects of the same class are
+    // allocated next to each other, which helps iteration locality and avoids a heap allocation per object.
+    template<typename T, typename... TARGS>
+    auto Emplace(TARGS&&... in_args) -> std::shared_ptr<T>
+    {
+        static_assert(std::is_base_of_v<DQueryInterface, T>, "Emplaced objects must implement DQueryInterface.");
+        auto object = std::allocate_shared<T>(DPoolAllocator<T, DObjectPool<TMUTEXTYPE>>(GetObjectPool<T>()), std::forward<TARGS>(in_args)...);
+        RequestAddObject(object);
+        return object;
     }
 
     auto RequestRemoveObject(std::shared_ptr<DQueryInterface> in_object, std::function<auto (std::shared_ptr<DQueryInterface>&) -> DQueryInterface::EPredicateResult> in_optProcessRemovalPredicateFn) noexcept -> void
@@ -72,104 +972,984 @@ struct DObjectRegistry final
         assert(in_object);
         if (in_optProcessRemovalPredicateFn && (in_optProcessRemovalPredicateFn(in_object) == DQueryInterface::EPredicateResult::CancellationRequested))
             return;
-        auto&& _ = std::scoped_lock(m_objectsToRemoveLock);
-        m_objectsToRemove.push_back(in_object);
+        m_objectsToRemove.Push(std::move(in_object));
+    }
+
+    // Bulk versions of RequestAddObject() and RequestRemoveObject(), taking a range of std::shared_ptr (a
+    // container, a DSpan...) or a pair of forward iterators. The whole range is queued at once, and the commit
+    // reserves room for the additions. Elements are copied, except from an rvalue container owning them or through
+    // move iterators, which move them.
+    template<typename TRANGE>
+    auto RequestAddObjects(TRANGE&& in_objects) noexcept -> void
+    {
+        if constexpr (IsMovableRange<TRANGE>)
+            RequestAddObjects(std::make_move_iterator(std::begin(in_objects)), std::make_move_iterator(std::end(in_objects)));
+        else
+            RequestAddObjects(std::begin(in_objects), std::end(in_objects));
+    }
+
+    template<typename TITERATOR>
+    auto RequestAddObjects(TITERATOR in_first, TITERATOR in_last) noexcept -> void
+    {
+        assert(std::all_of(in_first, in_last, [](const auto& in_object) { return static_cast<bool>(in_object); }));
+        m_pendingAddCount.fetch_add(m_objectsToAdd.PushRange(in_first, in_last), std::memory_order_relaxed);
+    }
+
+    template<typename TRANGE>
+    auto RequestRemoveObjects(TRANGE&& in_objects) noexcept -> void
+    {
+        if constexpr (IsMovableRange<TRANGE>)
+            RequestRemoveObjects(std::make_move_iterator(std::begin(in_objects)), std::make_move_iterator(std::end(in_objects)));
+        else
+            RequestRemoveObjects(std::begin(in_objects), std::end(in_objects));
     }
 
-    auto ForEach(std::function<auto (const std::shared_ptr<DQueryInterface>&) -> DQueryInterface::EPredicateResult> in_predicateFn) noexcept -> void
+    template<typename TITERATOR>
+    auto RequestRemoveObjects(TITERATOR in_first, TITERATOR in_last) noexcept -> void
     {
-        assert(in_predicateFn);
-        auto&& _ = std::scoped_lock(m_objectsLock);
-        if (m_objectsToAdd.size() || m_objectsToRemove.size())
+        assert(std::all_of(in_first, in_last, [](const auto& in_object) { return static_cast<bool>(in_object); }));
+        m_objectsToRemove.PushRange(in_first, in_last);
+    }
+
+    // Applies pending changes, then removes every object for which the predicate, taking (const std::shared_ptr<
+    // DQueryInterface>&) and returning bool, is true. One linear pass compacts the objects, and all the removals
+    // form a single commit. The predicate runs under the registry's mutex: it must not call into the registry or its
+    // collections. Returns the number of objects the predicate selected; expired weak references purged on the way
+    // are not counted.
+    template<typename TPREDICATEFN>
+    auto RemoveIf(TPREDICATEFN&& in_predicateFn) noexcept -> size_t
+    {
+        static_assert(std::is_invocable_r_v<bool, TPREDICATEFN&, const std::shared_ptr<DQueryInterface>&>, "Predicate must take (const std::shared_ptr<DQueryInterface>&) and return bool.");
+        assert(IsValidPredicate(in_predicateFn));
+        auto released = std::vector<std::shared_ptr<DQueryInterface>>();
+        auto removedCount = size_t(0);
         {
-            bool changed = false;
-            {// Process pending additions.
-                auto&& __ = std::scoped_lock(m_objectsToAddLock);
-                for (auto& it : m_objectsToAdd)
-                    if (std::find(m_objects.begin(), m_objects.end(), it) == m_objects.end())
-                    {
-                        m_objects.push_back(std::move(it));
-                        changed = true;
-                    }
-                m_objectsToAdd.clear();
-            }
-            {// Process pending removals.
-                auto&& __ = std::scoped_lock(m_objectsToRemoveLock);
-                for (auto& it : m_objectsToRemove)
-                {
-                    auto foundObject  = std::find(m_objects.begin(), m_objects.end(), it);
-                    if ( foundObject != m_objects.end() )
-                    {// Remove (order is not kept).
-                        *foundObject = m_objects.back();
-                        m_objects.pop_back();
-                        changed = true;
-                    }
-                }
-                m_objectsToRemove.clear();
-            }
-            if (changed)
-                ++m_generationId;
+            auto&& _ = std::scoped_lock(m_objectsLock);
+            CommitPendingChanges(released);
+            removedCount = RemoveObjectsIf(in_predicateFn, released);
         }
-        for (auto& it : m_objects)
-            if (in_predicateFn(it) == DQueryInterface::EPredicateResult::CancellationRequested)
-                break;
+        ReleaseObjects(released);
+        return removedCount;
     }
 
-private:
-    template<typename TINTERFACE>
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    // Handle of a committed object, or an invalid handle if the object is not registered (yet).
+    auto GetObjectHandle(const DQueryInterface* in_object) noexcept -> DObjectHandle
+    {
+        auto&& _ = DThreadReadLock(*this);
+        auto foundIndex  = m_objectIndices.find(in_object);
+        if ( foundIndex == m_objectIndices.end() )
+            return DObjectHandle();
+        const auto slotIndex = m_objectSlots[foundIndex->second];
+        return DObjectHandle{ slotIndex, m_slots[slotIndex].m_generation };
+    }
+
+    // Object referenced by a handle, or null if it has been removed since.
+    auto ResolveObject(DObjectHandle in_handle) noexcept -> std::shared_ptr<DQueryInterface>
+    {
+        auto&& _ = DThreadReadLock(*this);
+        const auto* object = FindObject(in_handle);
+        return object ? *object : nullptr;
+    }
+
+    // The handle is resolved by the commit, so this never takes the mutex and can be called from an iteration.
+    auto RequestRemoveObject(DObjectHandle in_handle) noexcept -> void
+    {
+        m_handlesToRemove.Push(in_handle);
+    }
+#endif
+
+    // Applies pending additions and removals. ForEach() does it implicitly; call it explicitly at a sync point
+    // (e.g. a frame boundary) and iterate with ForEachCommitted() to keep iteration free of flushes. References
+    // dropped by the commit are released once the mutex is unlocked, so destructors never run under it.
+    auto Commit() noexcept -> void
+    {
+        if (!HasPendingChanges())
+            return;
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        if (IsReadLockedByThisThread())
+            return; // Called from an iteration, whose objects must stay alive: the next commit applies the changes.
+#endif
+        auto released = std::vector<std::shared_ptr<DQueryInterface>>();
+        {
+            auto&& _ = std::scoped_lock(m_objectsLock);
+            CommitPendingChanges(released);
+        }
+        ReleaseObjects(released);
+    }
+
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE)
+    // Drops the references that commits and collections released since the last call, running the destructors of
+    // the objects nobody else holds. Call it from a background thread or at a point where the cost is acceptable.
+    auto ReleaseDeferredObjects() noexcept -> void
+    {
+        auto&& _ = std::scoped_lock(m_objectsToReleaseLock);
+        m_objectsToRelease.Drain([](std::shared_ptr<DQueryInterface>&&) { ; });
+    }
+#endif
+
+    // Applies pending changes, then iterates. Accepts any callable taking (const std::shared_ptr<DQueryInterface>&)
+    // and returning EPredicateResult.
+    template<typename TPREDICATEFN>
+    auto ForEach(TPREDICATEFN&& in_predicateFn) noexcept -> void
+    {
+        Commit();
+        ForEachCommitted(in_predicateFn);
+    }
+
+    // Iterates the objects as of the last commit. Pending changes are left untouched. With a shared mutex
+    // type, any number of threads can iterate at the same time.
+    template<typename TPREDICATEFN>
+    auto ForEachCommitted(TPREDICATEFN&& in_predicateFn) noexcept -> void
+    {
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        auto&& _ = DThreadReadLock(*this);
+#else
+        auto&& _ = ReadLock(m_objectsLock);
+#endif
+        IterateObjects(in_predicateFn);
+    }
+
+    template<typename... TTERMS>
     struct DInterfaceCollection final
     {
+        using DQuery = DInterfaceQuery<TTERMS...>;
+        static_assert(DQuery::RequiredCount > 0, "DInterfaceCollection requires at least one required interface.");
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        using DObjectEntry = DQueryInterface*; // Collections do not own objects, the registry keeps them alive.
+#else
+        using DObjectEntry = DObjectReference;
+#endif
+
         DInterfaceCollection() = delete;
        ~DInterfaceCollection() = default;
 
-        auto ForEach(std::function<auto (const std::shared_ptr<DQueryInterface>&) -> DQueryInterface::EPredicateResult> in_predicateFn) noexcept -> void
+        // Commits the registry, then iterates. Accepts any callable taking either the required interfaces by
+        // reference followed by the optional ones by pointer, or (const std::shared_ptr<DQueryInterface>&), and
+        // returning EPredicateResult.
+        template<typename TPREDICATEFN>
+        auto ForEach(TPREDICATEFN&& in_predicateFn) noexcept -> void
         {
-            assert(in_predicateFn);
-            auto&& _ = std::scoped_lock(m_objectsLock);
-            if (m_generationId != m_registry.GetGenerationId())
+            m_registry.Commit();
+            ForEachCommitted(in_predicateFn);
+        }
+
+        // Iterates the objects as of the registry's last commit.
+        template<typename TPREDICATEFN>
+        auto ForEachCommitted(TPREDICATEFN&& in_predicateFn) noexcept -> void
+        {
+            assert(IsValidPredicate(in_predicateFn));
+            auto&& _ = LockUpToDate();
+            for (auto i = size_t(0), count = m_objects.size(); i < count; ++i)
+                if (InvokePredicate(in_predicateFn, i) == DQueryInterface::EPredicateResult::CancellationRequested)
+                    break;
+        }
+
+        // Commits the registry, then hands the objects over in consecutive chunks of up to in_chunkSize, for batch
+        // prefetching or vectorizing. The callable takes one DSpan<TINTERFACE* const> per required interface followed by
+        // one per optional interface (null entries when not implemented), or a DSpan<const DObjectEntry>. Returning
+        // CancellationRequested stops after the current chunk.
+        template<typename TCHUNKFN>
+        auto ForEachChunk(TCHUNKFN&& in_chunkFn, size_t in_chunkSize = DefaultChunkSize) noexcept -> void
+        {
+            constexpr bool isInterfaceChunkFn = DQuery::template IsChunkInvocable<TCHUNKFN>;
+            static_assert(isInterfaceChunkFn || std::is_invocable_r_v<DQueryInterface::EPredicateResult, TCHUNKFN&, DSpan<const DObjectEntry>>, "Chunk callable must take (DSpan<TINTERFACE* const>...) or (DSpan<const DObjectEntry>).");
+            assert(IsValidPredicate(in_chunkFn) && (in_chunkSize > 0));
+            m_registry.Commit();
+            auto&& _ = LockUpToDate();
+            for (auto i = size_t(0), count = m_objects.size(); i < count; i += in_chunkSize)
             {
-                m_objects .clear();
-                m_registry.ForEach([this](const std::shared_ptr<DQueryInterface>& in_object) -> DQueryInterface::EPredicateResult
-                {
-                    if (in_object->HasInterface<TINTERFACE>())
-                        m_objects.push_back(in_object);
-                    return DQueryInterface::EPredicateResult::Ok;
-                });
-                m_generationId  = m_registry.GetGenerationId();
-            }
-            for (auto& it : m_objects)
-                if (in_predicateFn(it) == DQueryInterface::EPredicateResult::CancellationRequested)
+                const auto chunkCount = std::min(in_chunkSize, count - i);
+                auto result = DQueryInterface::EPredicateResult::Ok;
+                if constexpr (isInterfaceChunkFn)
+                    result = DQuery::InvokeChunk(in_chunkFn, m_interfaces, i, chunkCount);
+                else
+                    result = in_chunkFn(DSpan<const DObjectEntry>(m_objects.data() + i, chunkCount));
+                if (result == DQueryInterface::EPredicateResult::CancellationRequested)
                     break;
+            }
         }
 
-        auto ForEach(std::function<auto (TINTERFACE&) -> DQueryInterface::EPredicateResult> in_predicateFn) noexcept -> void
+        // Commits the registry, then runs the predicate over chunks of in_chunkSize objects on the given executor
+        // (see DThreadPoolExecutor). Tasks claim chunks from a shared cursor, so faster workers take more of them.
+        // A CancellationRequested result stops every task at its next element; the predicate must be thread-safe.
+        template<typename TEXECUTOR, typename TPREDICATEFN>
+        auto ForEachParallel(TEXECUTOR& in_executor, TPREDICATEFN&& in_predicateFn, size_t in_chunkSize = DefaultChunkSize) noexcept -> void
         {
-            assert(in_predicateFn);
-            ForEach([in_predicateFn](const std::shared_ptr<DQueryInterface>& in_object) -> DQueryInterface::EPredicateResult 
-            { 
-                return in_predicateFn(*in_object->QueryInterface<TINTERFACE>()); 
+            assert(IsValidPredicate(in_predicateFn) && (in_chunkSize > 0));
+            m_registry.Commit();
+            auto&& _ = LockUpToDate();
+            const auto count      = m_objects.size();
+            const auto chunkCount = (count + in_chunkSize - 1) / in_chunkSize;
+            if (chunkCount == 0)
+                return;
+            auto nextChunk = std::atomic<size_t>(0);
+            auto cancelled = std::atomic<bool>(false);
+            in_executor.Execute(std::min<size_t>(chunkCount, in_executor.GetConcurrency()), [&](size_t) noexcept
+            {
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+                auto&& _ = DThreadReadLock(m_registry, true);
+#endif
+                for (auto chunk = nextChunk.fetch_add(1, std::memory_order_relaxed); chunk < chunkCount; chunk = nextChunk.fetch_add(1, std::memory_order_relaxed))
+                    for (auto i = chunk * in_chunkSize, end = std::min(count, i + in_chunkSize); i < end; ++i)
+                    {
+                        if (cancelled.load(std::memory_order_relaxed))
+                            return;
+                        if (InvokePredicate(in_predicateFn, i) == DQueryInterface::EPredicateResult::CancellationRequested)
+                            cancelled.store(true, std::memory_order_relaxed);
+                    }
             });
         }
 
+        // Commits the registry, then hands the objects of each listed concrete class (a DImplements class or a class
+        // deriving from one) to its kernel, taking DSpan<TCONCRETES* const>, in one batch. Objects of derived classes
+        // go to the kernel of their DImplements class. The last callable is a regular predicate for the other
+        // objects. Mark the concrete classes final to let the compiler devirtualize the kernels.
+        template<typename... TCONCRETES, typename... TFNS>
+        auto ForEachByConcreteType(TFNS&&... in_fns) noexcept -> void
+        {
+            static_assert(sizeof...(TFNS) == sizeof...(TCONCRETES) + 1, "ForEachByConcreteType expects one kernel per concrete type, then a predicate.");
+            static_assert((std::is_same_v<typename TCONCRETES::DImplementsSelf, TCONCRETES> && ...), "Concrete types must derive from DImplements<TCONCRETE, ...>.");
+            m_registry.Commit();
+            auto&& _ = LockUpToDate();
+            auto batches = std::tuple<std::vector<TCONCRETES*>...>(DScratch<TCONCRETES*>::Borrow()...);
+            auto others  = DScratch<size_t>::Borrow();
+            for (auto i = size_t(0), count = m_objects.size(); i < count; ++i)
+            {
+                auto* object = PointerOf(m_objects[i]);
+                if (!(AddToBatch<TCONCRETES>(object, std::get<std::vector<TCONCRETES*>>(batches)) || ...))
+                    others.push_back(i);
+            }
+            auto fns = std::forward_as_tuple(in_fns...);
+            if (!RunKernels(fns, batches, std::index_sequence_for<TCONCRETES...>()))
+            {
+                auto& predicateFn = std::get<sizeof...(TCONCRETES)>(fns);
+                assert(IsValidPredicate(predicateFn));
+                for (const auto index : others)
+                    if (InvokePredicate(predicateFn, index) == DQueryInterface::EPredicateResult::CancellationRequested)
+                        break;
+            }
+            (DScratch<TCONCRETES*>::GiveBack(std::move(std::get<std::vector<TCONCRETES*>>(batches))), ...);
+            DScratch<size_t>::GiveBack(std::move(others));
+        }
+
     private:
         friend struct DObjectRegistry;
 
-        std::vector<std::shared_ptr<DQueryInterface>> m_objects;
+        std::vector<DObjectEntry> m_objects;
+        typename DQuery::DArrays m_interfaces; // One array per interface, parallel to m_objects.
+        std::unordered_map<const DQueryInterface*, size_t> m_objectIndices;
         TMUTEXTYPE      m_objectsLock;
-        unsigned int    m_generationId = UINT_MAX;
-        struct DObjectRegistry<TMUTEXTYPE>& m_registry;
-        DInterfaceCollection    (struct DObjectRegistry<TMUTEXTYPE>& in_registry) : m_registry(in_registry) { ; }
+        std::atomic<unsigned int> m_generationId = UINT_MAX;
+        DObjectRegistry& m_registry;
+        struct DTypeGroup
+        {
+            const void* m_dynamicType;
+            size_t      m_count;
+        };
+        std::vector<DTypeGroup> m_typeGroups; // Consecutive runs of m_objects, in order. GroupedByType only.
+        const ECollectionOrder  m_order;
+        DInterfaceCollection    (DObjectRegistry& in_registry, ECollectionOrder in_order) : m_registry(in_registry), m_order(in_order) { ; }
         DInterfaceCollection    (const DInterfaceCollection&)           = delete;
         DInterfaceCollection    (DInterfaceCollection&&)                = delete;
         DInterfaceCollection&   operator=(const DInterfaceCollection&)  = delete;
-        auto GetGenerationId()  const noexcept -> unsigned int { return m_generationId; }
+        auto GetGenerationId()  const noexcept -> unsigned int { return m_generationId.load(std::memory_order_acquire); }
+
+        static constexpr size_t DefaultChunkSize = 256;
+
+        template<typename TPREDICATEFN>
+        static constexpr bool IsInterfacePredicate = DQuery::template IsInvocable<TPREDICATEFN>;
+
+        template<typename TPREDICATEFN>
+        auto InvokePredicate(TPREDICATEFN& in_predicateFn, size_t in_index) noexcept -> DQueryInterface::EPredicateResult
+        {// Interface predicates read the cached pointers, object predicates the owning pointers.
+            static_assert(IsInterfacePredicate<TPREDICATEFN> || std::is_invocable_r_v<DQueryInterface::EPredicateResult, TPREDICATEFN&, const std::shared_ptr<DQueryInterface>&>, "Predicate must take (required interfaces&..., optional interfaces*...) or (const std::shared_ptr<DQueryInterface>&).");
+            if constexpr (IsInterfacePredicate<TPREDICATEFN>)
+                return DQuery::Invoke(in_predicateFn, m_interfaces, in_index);
+            else
+                return in_predicateFn(GetOwningPointer(in_index));
+        }
+
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        auto GetOwningPointer(size_t in_index) const noexcept -> const std::shared_ptr<DQueryInterface>&
+        {// Requires the read locks. The owning pointer is looked up in the registry.
+            return m_registry.m_objects[m_registry.m_objectIndices.find(m_objects[in_index])->second];
+        }
+#elif defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+        auto GetOwningPointer(size_t in_index) const noexcept -> std::shared_ptr<DQueryInterface>
+        {// Requires the read lock. The object is pinned, so this never returns null.
+            return m_objects[in_index].m_object.lock();
+        }
+#else
+        auto GetOwningPointer(size_t in_index) const noexcept -> const std::shared_ptr<DQueryInterface>&
+        {// Requires the read lock.
+            return m_objects[in_index];
+        }
+#endif
+
+        template<typename T>
+        struct DScratch final
+        {// Per-thread buffers reused across calls. Borrowing moves the buffer out, so nested calls just get a new one.
+            static auto Borrow() noexcept -> std::vector<T> { auto result = std::move(s_buffer); result.clear(); return result; }
+            static auto GiveBack(std::vector<T>&& in_buffer) noexcept -> void { s_buffer = std::move(in_buffer); }
+        private:
+            static inline thread_local std::vector<T> s_buffer;
+        };
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+        struct DPinnedObjects final
+        {// Strong references keeping the objects alive for the duration of an iteration.
+            DPinnedObjects() noexcept : m_objects(DScratch<std::shared_ptr<DQueryInterface>>::Borrow()) { ; }
+            DPinnedObjects(DPinnedObjects&&) noexcept = default;
+           ~DPinnedObjects()
+            {// Releasing can destroy objects, possibly iterating on this thread: clear before giving the buffer back.
+                m_objects.clear();
+                DScratch<std::shared_ptr<DQueryInterface>>::GiveBack(std::move(m_objects));
+            }
+
+            // Returns false if an object has expired.
+            auto Pin(const std::vector<DObjectEntry>& in_entries) noexcept -> bool
+            {
+                m_objects.reserve(in_entries.size());
+                for (auto& it : in_entries)
+                    if (!m_objects.emplace_back(it.m_object.lock()))
+                        return false;
+                return true;
+            }
+
+        private:
+            std::vector<std::shared_ptr<DQueryInterface>> m_objects;
+        };
+#endif
+
+        template<typename TCONCRETE>
+        static auto AddToBatch(DQueryInterface* in_object, std::vector<TCONCRETE*>& out_batch) noexcept -> bool
+        {
+            if (in_object->GetClassInfo() != &TCONCRETE::GetImplementsClassInfo())
+                return false;
+            out_batch.push_back(static_cast<TCONCRETE*>(in_object));
+            return true;
+        }
+
+        template<typename TFNTUPLE, typename TBATCHTUPLE, size_t... TINDICES>
+        static auto RunKernels(TFNTUPLE& in_fns, TBATCHTUPLE& in_batches, std::index_sequence<TINDICES...>) noexcept -> bool
+        {// Returns true if a kernel requested cancellation.
+            bool cancelled = false;
+            ((cancelled = cancelled || (!std::get<TINDICES>(in_batches).empty() && (RunKernel(std::get<TINDICES>(in_fns), std::get<TINDICES>(in_batches)) == DQueryInterface::EPredicateResult::CancellationRequested))), ...);
+            return cancelled;
+        }
+
+        template<typename TKERNELFN, typename TCONCRETE>
+        static auto RunKernel(TKERNELFN& in_kernelFn, const std::vector<TCONCRETE*>& in_batch) noexcept -> DQueryInterface::EPredicateResult
+        {
+            static_assert(std::is_invocable_r_v<DQueryInterface::EPredicateResult, TKERNELFN&, DSpan<TCONCRETE* const>>, "Kernels must take (DSpan<TCONCRETE* const>).");
+            assert(IsValidPredicate(in_kernelFn));
+            return in_kernelFn(DSpan<TCONCRETE* const>(in_batch.data(), in_batch.size()));
+        }
+
+        auto LockUpToDate() noexcept
+        {// Returns read locks on the up-to-date objects.
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+            // The registry owns the objects, so it must not commit while iterating. Its lock comes first, as in the
+            // nested iterations that already hold it.
+            auto registryLock   = DThreadReadLock(m_registry);
+            CatchUp();
+            auto collectionLock = ReadLock(m_objectsLock);
+            return std::make_pair(std::move(registryLock), std::move(collectionLock));
+#elif defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+            for (;;)
+            {// Objects can expire at any time: pin them, or purge the expired ones and retry. The lock is released
+             // before the pins, so the last releases happen outside of it.
+                CatchUp();
+                auto lock = ReadLock(m_objectsLock);
+                auto pins = DPinnedObjects();
+                if (pins.Pin(m_objects))
+                    return std::make_pair(std::move(pins), std::move(lock));
+                lock.unlock();
+                auto released = std::vector<DObjectEntry>();
+                auto&& _ = std::scoped_lock(m_objectsLock);
+                PurgeExpiredObjects(released);
+            }
+#else
+            CatchUp();
+            return ReadLock(m_objectsLock);
+#endif
+        }
+
+        auto CatchUp() noexcept -> void
+        {// Updates under the exclusive lock if needed.
+            auto seenId = GetGenerationId();
+            const auto generationId = m_registry.GetGenerationId();
+            if (seenId == generationId)
+                return;
+            if (m_registry.HaveInterfacesChangedSince(typename DQuery::DRequired(), seenId, generationId))
+            {
+                auto released = std::vector<DObjectEntry>();
+                {
+                    auto&& _ = std::scoped_lock(m_objectsLock);
+                    RefreshObjects(released);
+                }
+                m_registry.ReleaseObjects(released);
+            }
+            else
+            {// Unrelated changes only: catch up without touching the objects, so the change log keeps covering us.
+                m_generationId.compare_exchange_strong(seenId, generationId, std::memory_order_release, std::memory_order_relaxed);
+            }
+        }
+
+        auto RefreshObjects(std::vector<DObjectEntry>& out_released) noexcept -> void
+        {// Requires m_objectsLock. Replays the registry's change log when it still covers our generation. Removed
+         // entries go to out_released, to be released once unlocked.
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+            auto&& _ = DThreadReadLock(m_registry);
+#else
+            auto&& _ = ReadLock(m_registry.m_objectsLock);
+#endif
+            const auto generationId = m_registry.m_generationId.load(std::memory_order_relaxed);
+            const auto seenId       = m_generationId.load(std::memory_order_relaxed);
+            if (seenId == generationId)
+                return;
+            if (m_registry.IsInChangeLog(seenId))
+                ApplyChanges(seenId, out_released);
+            else
+                Rebuild(out_released);
+            m_generationId.store(generationId, std::memory_order_release);
+        }
+
+        auto ApplyChanges(unsigned int in_seenId, std::vector<DObjectEntry>& out_released) noexcept -> void
+        {// Requires both locks. Additions are looked up in the registry; an object removed since then has a later removal record.
+            const auto& changeLog = m_registry.m_changeLog;
+            const auto  baseId    = m_registry.m_changeLogBaseId;
+            auto it = std::partition_point(changeLog.begin(), changeLog.end(), [=](const auto& in_entry) { return (in_entry.m_generationId - baseId) <= (in_seenId - baseId); });
+            for (; it != changeLog.end(); ++it)
+            {
+                if (!it->m_added)
+                    RemoveObject(it->m_object, out_released);
+                else if (auto foundIndex = m_registry.m_objectIndices.find(it->m_object); foundIndex != m_registry.m_objectIndices.end())
+                    if (auto&& object = Lock(m_registry.m_objects[foundIndex->second]))
+                        AddObject(object);
+            }
+        }
+
+        auto Rebuild(std::vector<DObjectEntry>& out_released) noexcept -> void
+        {// Requires both locks.
+            std::move(m_objects.begin(), m_objects.end(), std::back_inserter(out_released));
+            m_objects      .clear();
+            m_objectIndices.clear();
+            m_typeGroups   .clear();
+            std::apply([](auto&... in_interfaces) { (in_interfaces.clear(), ...); }, m_interfaces);
+            for (auto& it : m_registry.m_objects)
+                if (auto&& object = Lock(it)) // Expired objects are skipped.
+                    AddObject(object);
+        }
+
+        auto AddObject(const std::shared_ptr<DQueryInterface>& in_object) noexcept -> void
+        {// Filter and resolve once per addition, iterations read the cached pointers.
+            if (DQuery::Matches(*in_object) && m_objectIndices.emplace(in_object.get(), m_objects.size()).second)
+            {
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+                m_objects.push_back(in_object.get());
+#elif defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+                m_objects.push_back({ in_object, in_object.get(), in_object->GetClassInfo() });
+#else
+                m_objects.push_back(in_object);
+#endif
+                std::apply([this](auto*... in_resolved)
+                {
+                    std::apply([&](auto&... in_interfaces) { (in_interfaces.push_back(in_resolved), ...); }, m_interfaces);
+                }, DQuery::Resolve(*in_object));
+                if (m_order == ECollectionOrder::GroupedByType)
+                    InsertIntoTypeGroup(m_objects.size() - 1);
+            }
+        }
+
+        auto RemoveObject(const DQueryInterface* in_object, std::vector<DObjectEntry>& out_released) noexcept -> void
+        {
+            auto foundIndex  = m_objectIndices.find(in_object);
+            if ( foundIndex != m_objectIndices.end() )
+            {// Remove (order is not kept, other than the grouping by type).
+                auto index = foundIndex->second;
+                if (m_order == ECollectionOrder::GroupedByType)
+                    index = RemoveFromTypeGroup(index);
+                SwapElements(index, m_objects.size() - 1);
+                m_objectIndices.erase(in_object);
+                out_released.push_back(std::move(m_objects.back()));
+                m_objects.pop_back();
+                std::apply([](auto&... in_interfaces) { (in_interfaces.pop_back(), ...); }, m_interfaces);
+            }
+        }
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+        auto PurgeExpiredObjects(std::vector<DObjectEntry>& out_released) noexcept -> void
+        {// Requires m_objectsLock. Back to front, as removals only move elements from later positions. Flags the
+         // registry so its next commit purges them too.
+            for (auto i = m_objects.size(); i-- > 0;)
+                if (m_objects[i].m_object.expired())
+                    RemoveObject(m_objects[i].m_pointer, out_released);
+            m_registry.m_expiredObjectsFound.store(true, std::memory_order_relaxed);
+        }
+#endif
+
+        auto SwapElements(size_t in_index1, size_t in_index2) noexcept -> void
+        {
+            if (in_index1 == in_index2)
+                return;
+            std::swap(m_objects[in_index1], m_objects[in_index2]);
+            std::apply([=](auto&... in_interfaces) { (std::swap(in_interfaces[in_index1], in_interfaces[in_index2]), ...); }, m_interfaces);
+            m_objectIndices[PointerOf(m_objects[in_index1])] = in_index1;
+            m_objectIndices[PointerOf(m_objects[in_index2])] = in_index2;
+        }
+
+        auto InsertIntoTypeGroup(size_t in_index) noexcept -> void
+        {// The appended element is swapped down to the end of its group, through the first element of each later group.
+            const auto* dynamicType = PointerOf(m_objects[in_index])->GetDynamicType();
+            auto foundGroup  = std::find_if(m_typeGroups.begin(), m_typeGroups.end(), [dynamicType](const DTypeGroup& in_group) { return in_group.m_dynamicType == dynamicType; });
+            if ( foundGroup == m_typeGroups.end() )
+            {// First object of its type.
+                m_typeGroups.push_back({ dynamicType, 1 });
+                return;
+            }
+            auto index = in_index;
+            for (auto it = m_typeGroups.end() - 1; it != foundGroup; --it)
+            {
+                SwapElements(index - it->m_count, index);
+                index -= it->m_count;
+            }
+            ++foundGroup->m_count;
+        }
+
+        auto RemoveFromTypeGroup(size_t in_index) noexcept -> size_t
+        {// Swaps the element to the end of its group, then through the last element of each later group. Returns its new
+         // index. The group is found by position: in handle mode the object may already be destroyed.
+            auto foundGroup = m_typeGroups.begin();
+            auto groupEnd   = foundGroup->m_count;
+            while (groupEnd <= in_index)
+                groupEnd += (++foundGroup)->m_count;
+            auto index = groupEnd - 1;
+            SwapElements(in_index, index);
+            for (auto it = foundGroup + 1; it != m_typeGroups.end(); ++it)
+            {
+                groupEnd += it->m_count;
+                SwapElements(index, groupEnd - 1);
+                index = groupEnd - 1;
+            }
+            if (--foundGroup->m_count == 0)
+                m_typeGroups.erase(foundGroup);
+            return index;
+        }
     };
 
-    std::vector<std::shared_ptr<DQueryInterface>> m_objects, m_objectsToAdd, m_objectsToRemove;
-    TMUTEXTYPE      m_objectsLock , m_objectsToAddLock, m_objectsToRemoveLock;
-    unsigned int    m_generationId = 0;
+private:
+    std::vector<DObjectReference> m_objects;
+    std::unordered_map<const DQueryInterface*, size_t> m_objectIndices; // Position of each object in m_objects.
+    DMpscQueue<std::shared_ptr<DQueryInterface>> m_objectsToAdd, m_objectsToRemove;
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    DMpscQueue<DObjectHandle> m_handlesToRemove;
+#endif
+    std::atomic<size_t> m_pendingAddCount = 0; // Queued by RequestAddObjects(), reserved by the next commit.
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE)
+    DMpscQueue<std::shared_ptr<DQueryInterface>> m_objectsToRelease; // Drained by ReleaseDeferredObjects().
+    TMUTEXTYPE      m_objectsToReleaseLock; // Serializes the drains.
+#endif
+    TMUTEXTYPE      m_objectsLock;
+    std::atomic<unsigned int> m_generationId = 0;
+    std::array<std::atomic<unsigned int>, DQUERYINTERFACE_MAX_INTERFACES> m_interfaceGenerationIds{}; // Last generation that added or removed an implementer, per interface index.
+    std::atomic<unsigned int> m_untypedGenerationId = 0; // Last generation that added or removed an object without class info.
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    std::atomic<bool> m_expiredObjectsFound = false; // Set by iterations that met an expired object, cleared by the purge.
+#endif
+
+    struct DChangeLogEntry
+    {
+        unsigned int            m_generationId; // Generation the change belongs to.
+        const DQueryInterface*  m_object;       // Identity only, it may have been destroyed since.
+        bool                    m_added;
+    };
+    static constexpr size_t ChangeLogCapacity = DQUERYINTERFACE_CHANGE_LOG_CAPACITY;
+    std::vector<DChangeLogEntry> m_changeLog;  // Changes of generations (m_changeLogBaseId, m_generationId], oldest first.
+    unsigned int    m_changeLogBaseId = 0;
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    struct DObjectSlot
+    {
+        uint32_t m_generation  = 0;
+        uint32_t m_objectIndex = DObjectHandle::InvalidIndex; // Position in m_objects, invalid while free.
+    };
+    std::vector<DObjectSlot> m_slots;
+    std::vector<uint32_t>    m_freeSlots;
+    std::vector<uint32_t>    m_objectSlots; // Slot of each object, parallel to m_objects.
+#endif
+    std::unordered_map<uint64_t, DObjectPool<TMUTEXTYPE>*> m_objectPools; // Per class, keyed by DTypeHashOf<T>(). Owns the pools.
+    std::array<std::atomic<DObjectPool<TMUTEXTYPE>*>, DQUERYINTERFACE_MAX_POOLED_CLASSES> m_classPools{}; // Lock-free lookups, by DPoolIndices.
+    TMUTEXTYPE      m_objectPoolsLock;
     DObjectRegistry (const DObjectRegistry&)          = delete;
     DObjectRegistry (DObjectRegistry&&)               = delete;
     DObjectRegistry&operator=(const DObjectRegistry&) = delete;
-    auto GetGenerationId() const noexcept -> unsigned int { return m_generationId; }
+    auto GetGenerationId() const noexcept -> unsigned int { return m_generationId.load(std::memory_order_acquire); }
+
+    template<typename T>
+    auto GetObjectPool() -> DObjectPool<TMUTEXTYPE>*
+    {// Lock-free once the class has its slot. Classes past the slots, or whose slot another module's class took, go
+     // through the map.
+        const auto index = DPoolIndices::IndexOf<T>();
+        if (index < m_classPools.size())
+            if (auto* pool = m_classPools[index].load(std::memory_order_acquire); pool && (pool->GetClassId() == DTypeHashOf<T>()))
+                return pool;
+        auto&& _ = std::scoped_lock(m_objectPoolsLock);
+        auto& pool = m_objectPools[DTypeHashOf<T>()];
+        if (!pool)
+            pool = new DObjectPool<TMUTEXTYPE>(DTypeHashOf<T>());
+        if ((index < m_classPools.size()) && !m_classPools[index].load(std::memory_order_relaxed))
+            m_classPools[index].store(pool, std::memory_order_release);
+        return pool;
+    }
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    auto HasPendingChanges() const noexcept -> bool { return !m_objectsToAdd.IsEmpty() || !m_objectsToRemove.IsEmpty() || m_expiredObjectsFound.load(std::memory_order_relaxed); }
+#elif defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    auto HasPendingChanges() const noexcept -> bool { return !m_objectsToAdd.IsEmpty() || !m_objectsToRemove.IsEmpty() || !m_handlesToRemove.IsEmpty(); }
+#else
+    auto HasPendingChanges() const noexcept -> bool { return !m_objectsToAdd.IsEmpty() || !m_objectsToRemove.IsEmpty(); }
+#endif
+
+    auto CommitPendingChanges(std::vector<std::shared_ptr<DQueryInterface>>& out_released) noexcept -> void
+    {// Requires m_objectsLock, which also makes this the single consumer of both queues. Every reference the commit
+     // drops goes to out_released, as it may be the last one.
+        if (!HasPendingChanges())
+            return;
+        const auto generationId = m_generationId.load(std::memory_order_relaxed) + 1;
+        auto changes = DChangeSet();
+        if (const auto addCount = m_pendingAddCount.exchange(0, std::memory_order_relaxed))
+        {// Bulk additions.
+            m_objects      .reserve(m_objects.size() + addCount);
+            m_objectIndices.reserve(m_objects.size() + addCount);
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+            m_objectSlots  .reserve(m_objects.size() + addCount);
+#endif
+        }
+        m_objectsToAdd.Drain([&](std::shared_ptr<DQueryInterface>&& in_object)
+        {// Process pending additions.
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+            if (auto foundIndex = m_objectIndices.find(in_object.get()); (foundIndex != m_objectIndices.end()) && m_objects[foundIndex->second].m_object.expired())
+            {// The address of an expired object was reused.
+                changes.Mark(m_objects[foundIndex->second].m_classInfo);
+                EraseObject(foundIndex->second, generationId, out_released);
+            }
+#endif
+            if (m_objectIndices.emplace(in_object.get(), m_objects.size()).second)
+            {
+                changes.Mark(in_object->GetClassInfo());
+                m_changeLog.push_back({ generationId, in_object.get(), true });
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+                m_objectSlots.push_back(AllocateSlot(static_cast<uint32_t>(m_objects.size())));
+#endif
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+                m_objects.push_back({ in_object, in_object.get(), in_object->GetClassInfo() });
+#else
+                m_objects.push_back(std::move(in_object));
+#endif
+            }
+            if (in_object)
+                out_released.push_back(std::move(in_object));
+        });
+        m_objectsToRemove.Drain([&](std::shared_ptr<DQueryInterface>&& in_object)
+        {// Process pending removals.
+            auto foundIndex  = m_objectIndices.find(in_object.get());
+            if ( foundIndex != m_objectIndices.end() )
+            {
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+                if (m_objects[foundIndex->second].m_object.expired())
+                {// Another object that lived at the same address, left to the purge.
+                    m_expiredObjectsFound.store(true, std::memory_order_relaxed);
+                    out_released.push_back(std::move(in_object));
+                    return;
+                }
+#endif
+                changes.Mark(in_object->GetClassInfo());
+                EraseObject(foundIndex->second, generationId, out_released);
+            }
+            out_released.push_back(std::move(in_object));
+        });
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        m_handlesToRemove.Drain([&](DObjectHandle&& in_handle)
+        {// Process removals by handle. Stale handles are ignored.
+            if (const auto* object = FindObject(in_handle))
+            {
+                changes.Mark(ClassInfoOf(*object));
+                EraseObject(m_slots[in_handle.m_index].m_objectIndex, generationId, out_released);
+            }
+        });
+#endif
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+        if (m_expiredObjectsFound.exchange(false, std::memory_order_relaxed))
+            for (auto i = m_objects.size(); i-- > 0;)
+                if (m_objects[i].m_object.expired())
+                {// Purge, back to front as erasing moves the last object in.
+                    changes.Mark(m_objects[i].m_classInfo);
+                    EraseObject(i, generationId, out_released);
+                }
+#endif
+        PublishChanges(generationId, changes);
+    }
+
+    template<typename TPREDICATEFN>
+    auto RemoveObjectsIf(TPREDICATEFN& in_predicateFn, std::vector<std::shared_ptr<DQueryInterface>>& out_released) noexcept -> size_t
+    {// Requires m_objectsLock. Kept objects slide down over the removed ones, keeping their order. Expired objects
+     // are removed too, but only the objects matching the predicate are counted.
+        const auto generationId = m_generationId.load(std::memory_order_relaxed) + 1;
+        auto changes = DChangeSet();
+        auto keptCount = size_t(0), removedCount = size_t(0);
+        for (auto i = size_t(0), count = m_objects.size(); i < count; ++i)
+        {
+            auto&& object = Lock(m_objects[i]);
+            if (object && !in_predicateFn(object))
+            {
+                if (keptCount != i)
+                {
+                    m_objects[keptCount] = std::move(m_objects[i]);
+                    m_objectIndices[PointerOf(m_objects[keptCount])] = keptCount;
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+                    m_objectSlots[keptCount] = m_objectSlots[i];
+                    m_slots[m_objectSlots[keptCount]].m_objectIndex = static_cast<uint32_t>(keptCount);
+#endif
+                }
+                ++keptCount;
+                continue;
+            }
+            const auto* pointer = PointerOf(m_objects[i]);
+            changes.Mark(ClassInfoOf(m_objects[i]));
+            m_changeLog.push_back({ generationId, pointer, false });
+            m_objectIndices.erase(pointer);
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+            FreeSlot(m_objectSlots[i]);
+#endif
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+            if (!object)
+                continue;
+            out_released.push_back(std::move(object));
+#else
+            out_released.push_back(std::move(m_objects[i]));
+#endif
+            ++removedCount;
+        }
+        m_objects.erase(m_objects.begin() + keptCount, m_objects.end());
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        m_objectSlots.erase(m_objectSlots.begin() + keptCount, m_objectSlots.end());
+#endif
+        PublishChanges(generationId, changes);
+        return removedCount;
+    }
+
+    struct DChangeSet
+    {// Interfaces whose implementers a generation added or removed.
+        DInterfaceMask  m_interfaces;
+        bool            m_untyped = false;
+        bool            m_any     = false;
+
+        auto Mark(const DQueryInterface::DClassInfo* in_classInfo) noexcept -> void
+        {
+            if (in_classInfo && (in_classInfo->m_indexDomain == DInterfaceIndices::GetDomain()))
+                m_interfaces |= in_classInfo->m_interfaceMask;
+            else
+                m_untyped = true;
+            m_any = true;
+        }
+    };
+
+    auto PublishChanges(unsigned int in_generationId, const DChangeSet& in_changes) noexcept -> void
+    {// Requires m_objectsLock. Per-interface generations are published before the registry generation that readers
+     // sample first.
+        if (!in_changes.m_any)
+            return;
+        for (auto i = size_t(0); i < in_changes.m_interfaces.size(); ++i)
+            if (in_changes.m_interfaces.test(i))
+                m_interfaceGenerationIds[i].store(in_generationId, std::memory_order_relaxed);
+        if (in_changes.m_untyped)
+            m_untypedGenerationId.store(in_generationId, std::memory_order_relaxed);
+        TrimChangeLog();
+        m_generationId.store(in_generationId, std::memory_order_release);
+    }
+
+    auto EraseObject(size_t in_index, unsigned int in_generationId, [[maybe_unused]] std::vector<std::shared_ptr<DQueryInterface>>& out_released) noexcept -> void
+    {// Requires m_objectsLock. The last object takes its place (order is not kept).
+        const auto* object = PointerOf(m_objects[in_index]);
+        m_changeLog.push_back({ in_generationId, object, false });
+        m_objectIndices.erase(object);
+#if !defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+        out_released.push_back(std::move(m_objects[in_index])); // Weak entries have nothing to release.
+#endif
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        FreeSlot(m_objectSlots[in_index]);
+#endif
+        if (in_index != m_objects.size() - 1)
+        {
+            m_objects[in_index] = std::move(m_objects.back());
+            m_objectIndices[PointerOf(m_objects[in_index])] = in_index;
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+            m_objectSlots[in_index] = m_objectSlots.back();
+            m_slots[m_objectSlots[in_index]].m_objectIndex = static_cast<uint32_t>(in_index);
+#endif
+        }
+        m_objects.pop_back();
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+        m_objectSlots.pop_back();
+#endif
+    }
+
+    template<typename... TINTERFACES>
+    auto HaveInterfacesChangedSince(DAll<TINTERFACES...>, unsigned int in_seenId, unsigned int in_generationId) const noexcept -> bool
+    {// Wrap-safe. Marks from a commit still in progress count as changes too, so they are never skipped. An object
+     // relevant to the collection marks all its required interfaces, so every mark must be newer; interfaces without
+     // an index do not narrow the check.
+        const auto isNewer = [in_seenId](unsigned int in_markId) { return static_cast<int>(in_markId - in_seenId) > 0; };
+        if (isNewer(m_untypedGenerationId.load(std::memory_order_relaxed)))
+            return true;
+        bool indexed = false, allNewer = true;
+        for (const auto index : { DInterfaceIndexOf<TINTERFACES>()... })
+            if (index != DInterfaceIndices::InvalidIndex)
+            {
+                indexed  = true;
+                allNewer = allNewer && isNewer(m_interfaceGenerationIds[index].load(std::memory_order_relaxed));
+            }
+        return indexed ? allNewer : (in_seenId != in_generationId);
+    }
+
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    auto AllocateSlot(uint32_t in_objectIndex) noexcept -> uint32_t
+    {
+        auto slotIndex = static_cast<uint32_t>(m_slots.size());
+        if (m_freeSlots.empty())
+            m_slots.emplace_back();
+        else
+        {
+            slotIndex = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        }
+        m_slots[slotIndex].m_objectIndex = in_objectIndex;
+        return slotIndex;
+    }
+
+    auto FreeSlot(uint32_t in_slotIndex) noexcept -> void
+    {// Bumping the generation invalidates the handles issued for the slot.
+        m_slots[in_slotIndex].m_objectIndex = DObjectHandle::InvalidIndex;
+        ++m_slots[in_slotIndex].m_generation;
+        m_freeSlots.push_back(in_slotIndex);
+    }
+
+    auto FindObject(DObjectHandle in_handle) const noexcept -> const std::shared_ptr<DQueryInterface>*
+    {// Requires m_objectsLock.
+        if ((in_handle.m_index >= m_slots.size()) || (m_slots[in_handle.m_index].m_generation != in_handle.m_generation) || (m_slots[in_handle.m_index].m_objectIndex == DObjectHandle::InvalidIndex))
+            return nullptr;
+        return &m_objects[m_slots[in_handle.m_index].m_objectIndex];
+    }
+#endif
+
+    auto IsInChangeLog(unsigned int in_generationId) const noexcept -> bool
+    {// Wrap-safe: true if in_generationId lies within [m_changeLogBaseId, m_generationId].
+        const auto generationId = m_generationId.load(std::memory_order_relaxed);
+        return (generationId - in_generationId) <= (generationId - m_changeLogBaseId);
+    }
+
+    auto TrimChangeLog() noexcept -> void
+    {// Drops whole generations, oldest first, once the log holds twice its capacity so the cost is amortized.
+        if (m_changeLog.size() <= ChangeLogCapacity * 2)
+            return;
+        auto firstKept = m_changeLog.end() - ChangeLogCapacity;
+        const auto droppedId = (firstKept - 1)->m_generationId;
+        firstKept = std::find_if(firstKept, m_changeLog.end(), [droppedId](const DChangeLogEntry& in_entry) { return in_entry.m_generationId != droppedId; });
+        m_changeLog.erase(m_changeLog.begin(), firstKept);
+        m_changeLogBaseId = droppedId;
+    }
+
+    template<typename TPREDICATEFN>
+    auto IterateObjects(TPREDICATEFN& in_predicateFn) noexcept -> void
+    {
+        static_assert(std::is_invocable_r_v<DQueryInterface::EPredicateResult, TPREDICATEFN&, const std::shared_ptr<DQueryInterface>&>, "Predicate must take (const std::shared_ptr<DQueryInterface>&).");
+        assert(IsValidPredicate(in_predicateFn));
+        for (auto& it : m_objects)
+        {
+            auto&& object = Lock(it);
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+            if (!object)
+            {// Expired, purged by the next commit.
+                m_expiredObjectsFound.store(true, std::memory_order_relaxed);
+                continue;
+            }
+#endif
+            if (in_predicateFn(object) == DQueryInterface::EPredicateResult::CancellationRequested)
+                break;
+        }
+    }
+
+    template<typename TENTRY>
+    auto ReleaseObjects(std::vector<TENTRY>& in_objects) noexcept -> void
+    {// Called without locks. With deferred release, owning references are queued for ReleaseDeferredObjects().
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE)
+        if constexpr (std::is_same_v<TENTRY, std::shared_ptr<DQueryInterface>>)
+            m_objectsToRelease.PushRange(std::make_move_iterator(in_objects.begin()), std::make_move_iterator(in_objects.end()));
+#endif
+        in_objects.clear();
+    }
+
+    static auto PointerOf(DQueryInterface* in_entry) noexcept -> DQueryInterface* { return in_entry; }
+    static auto PointerOf(const std::shared_ptr<DQueryInterface>& in_entry) noexcept -> DQueryInterface* { return in_entry.get(); }
+    static auto Lock     (const std::shared_ptr<DQueryInterface>& in_entry) noexcept -> const std::shared_ptr<DQueryInterface>& { return in_entry; }
+    static auto ClassInfoOf(const std::shared_ptr<DQueryInterface>& in_entry) noexcept -> const DQueryInterface::DClassInfo* { return in_entry->GetClassInfo(); }
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    static auto PointerOf(const DWeakObject& in_entry) noexcept -> DQueryInterface* { return in_entry.m_pointer; }
+    static auto Lock     (const DWeakObject& in_entry) noexcept -> std::shared_ptr<DQueryInterface> { return in_entry.m_object.lock(); }
+    static auto ClassInfoOf(const DWeakObject& in_entry) noexcept -> const DQueryInterface::DClassInfo* { return in_entry.m_classInfo; }
+#endif
+
+    static auto ReadLock(TMUTEXTYPE& in_mutex) noexcept
+    {
+        if constexpr (DIsSharedMutex<TMUTEXTYPE>::value)
+            return std::shared_lock<TMUTEXTYPE>(in_mutex);
+        else
+            return std::unique_lock<TMUTEXTYPE>(in_mutex);
+    }
+
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    // Read lock on m_objectsLock, taken once per thread. Iterations hold it, so the nested iterations and lookups of
+    // the same thread must not lock it again: that is undefined for shared mutexes, and deadlocks exclusive or
+    // writer-preferring ones. Parallel iteration workers adopt the lock held by the iterating thread.
+    struct DThreadReadLock final
+    {
+        explicit DThreadReadLock(DObjectRegistry& in_registry, bool in_adopt = false) noexcept
+        {
+            if (in_registry.IsReadLockedByThisThread())
+                return;
+            if (!in_adopt)
+                m_lock = ReadLock(in_registry.m_objectsLock);
+            m_registry = &in_registry;
+            s_threadReadLocks.push_back(m_registry);
+        }
+        DThreadReadLock(DThreadReadLock&& in_other) noexcept : m_lock(std::move(in_other.m_lock)), m_registry(std::exchange(in_other.m_registry, nullptr)) { ; }
+       ~DThreadReadLock()
+        {
+            if (m_registry)
+                s_threadReadLocks.erase(std::find(s_threadReadLocks.rbegin(), s_threadReadLocks.rend(), m_registry).base() - 1);
+        }
+
+    private:
+        decltype(ReadLock(std::declval<TMUTEXTYPE&>())) m_lock;
+        const DObjectRegistry* m_registry = nullptr;
+        DThreadReadLock (const DThreadReadLock&)          = delete;
+        DThreadReadLock&operator=(const DThreadReadLock&) = delete;
+    };
+    static inline thread_local std::vector<const DObjectRegistry*> s_threadReadLocks; // Registries read-locked by the calling thread.
+
+    auto IsReadLockedByThisThread() const noexcept -> bool { return std::find(s_threadReadLocks.begin(), s_threadReadLocks.end(), this) != s_threadReadLocks.end(); }
+#endif
+
+    template<typename TRANGE>
+    static constexpr bool IsMovableRange = !std::is_lvalue_reference_v<TRANGE> && DIsOwningRange<std::remove_cv_t<TRANGE>>::value;
+
+    template<typename TPREDICATEFN>
+    static auto IsValidPredicate(const TPREDICATEFN& in_predicateFn) noexcept -> bool
+    {// Only nullable callables (std::function, function pointers) can be invalid.
+        if constexpr (std::is_constructible_v<bool, const TPREDICATEFN&>)
+            return static_cast<bool>(in_predicateFn);
+        else
+            return true;
+    }
 };
@@ -24,8 +24,11 @@
 
 #include "../dqueryinterface.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <memory>
+#include <vector>
 
 struct DFooInterface { virtual auto Foo() noexcept -> void = 0; };
 struct DBarInterface { virtual auto Bar() noexcept -> void = 0; };
@@ -40,30 +43,29 @@ struct DExampleClass
     auto Baz() noexcept -> void override { printf("Run Baz() from DExampleClass.\n"); }
 
 private:
+#if defined(DQUERYINTERFACE_USE_INTERFACE_IDS)
+    auto QueryInterfaceById(DInterfaceId in_interfaceId) const noexcept -> const void* override
+    {
+        if (DInterfaceIdOf<DBarInterface>() == in_interfaceId) return static_cast<const DBarInterface*>(this);
+        if (DInterfaceIdOf<DBazInterface>() == in_interfaceId) return static_cast<const DBazInterface*>(this);
+        return nullptr;
+    }
+#else
     auto QueryInterfaceByTypeId(const type_info& in_typeId) const noexcept -> const void* override
     {
         if (typeid(DBarInterface) == in_typeId) return static_cast<const DBarInterface*>(this);
         if (typeid(DBazInterface) == in_typeId) return static_cast<const DBazInterface*>(this);
         return nullptr;
     }
+#endif
 };
 
 struct DOtherExampleClass
-    : DQueryInterface
-    , DFooInterface, DBarInterface, DBazInterface
+    : DImplements<DOtherExampleClass, DFooInterface, DBarInterface, DBazInterface>
 {
     auto Foo() noexcept -> void override { printf("Run Foo() from DOtherExampleClass.\n"); }
     auto Bar() noexcept -> void override { printf("Run Bar() from DOtherExampleClass.\n"); }
     auto Baz() noexcept -> void override { printf("Run Baz() from DOtherExampleClass.\n"); }
-
-private:
-    auto QueryInterfaceByTypeId(const type_info& in_typeId) const noexcept -> const void* override
-    {
-        if (typeid(DFooInterface) == in_typeId) return static_cast<const DFooInterface*>(this);
-        if (typeid(DBarInterface) == in_typeId) return static_cast<const DBarInterface*>(this);
-        if (typeid(DBazInterface) == in_typeId) return static_cast<const DBazInterface*>(this);
-        return nullptr;
-    }
 };
 
 int main(int, char**)
@@ -109,6 +111,10 @@ int main(int, char**)
     assert( obj4->QueryInterface<DBarInterface>());
     assert( obj4->QueryInterface<DBazInterface>());
 
+    [[maybe_unused]] auto [obj1Foo, obj1Bar] = obj1->QueryInterfaces<DFooInterface, DBarInterface>();
+    [[maybe_unused]] auto [obj3Foo, obj3Baz] = obj3->QueryInterfaces<DFooInterface, DBazInterface>();
+    assert(!obj1Foo && (obj1Bar == obj1->QueryInterface<DBarInterface>()));
+    assert( obj3Foo && (obj3Baz == obj3->QueryInterface<DBazInterface>()));
 
     printf("--- TEST INTERFACE ACCESS ---\n");
     objectsImplementingFoo.ForEach([](DFooInterface& in_interface) noexcept -> DQueryInterface::EPredicateResult { in_interface.Foo(); return DQueryInterface::EPredicateResult::Ok; });
@@ -132,5 +138,146 @@ int main(int, char**)
     });
     printf("\n");
 
+    const auto countObjects = [](auto& in_collection) noexcept -> size_t
+    {
+        auto count = size_t(0);
+        in_collection.ForEach([&count](const std::shared_ptr<DQueryInterface>&) noexcept -> DQueryInterface::EPredicateResult { ++count; return DQueryInterface::EPredicateResult::Ok; });
+        return count;
+    };
+
+    {// Query terms: DNone excludes the objects implementing an interface, DOptional passes it as a pointer.
+        auto objectsImplementingBarOnly = objectRegistry.CreateInterfaceCollection<DBarInterface, DNone<DFooInterface>>();
+        auto objectsImplementingBazFoo  = objectRegistry.CreateInterfaceCollection<DBazInterface, DOptional<DFooInterface>>();
+        auto fooCount = size_t(0);
+        objectsImplementingBazFoo.ForEach([&fooCount](DBazInterface&, DFooInterface* in_foo) noexcept -> DQueryInterface::EPredicateResult { fooCount += (in_foo != nullptr); return DQueryInterface::EPredicateResult::Ok; });
+        assert((countObjects(objectsImplementingBarOnly) == 2) && (countObjects(objectsImplementingBazFoo) == 4) && (fooCount == 2));
+    }
+
+    {// Chunks, batches per concrete class and collections grouped by dynamic type see every object once.
+        auto chunkCount = size_t(0), chunkedCount = size_t(0);
+        objectsImplementingBar.ForEachChunk([&](DSpan<DBarInterface* const> in_chunk) noexcept -> DQueryInterface::EPredicateResult
+        {
+            ++chunkCount;
+            chunkedCount += in_chunk.size();
+            return DQueryInterface::EPredicateResult::Ok;
+        }, 3);
+        assert((chunkCount == 2) && (chunkedCount == 4));
+
+        auto batchedCount = size_t(0), otherCount = size_t(0);
+        objectsImplementingBar.ForEachByConcreteType<DOtherExampleClass>(
+            [&batchedCount](DSpan<DOtherExampleClass* const> in_batch) noexcept -> DQueryInterface::EPredicateResult { batchedCount += in_batch.size(); return DQueryInterface::EPredicateResult::Ok; },
+            [&otherCount](DBarInterface&) noexcept -> DQueryInterface::EPredicateResult { ++otherCount; return DQueryInterface::EPredicateResult::Ok; });
+        assert((batchedCount == 2) && (otherCount == 2));
+
+        auto groupedObjects = objectRegistry.CreateInterfaceCollection<DBarInterface>(ECollectionOrder::GroupedByType);
+        auto dynamicTypes   = std::vector<const void*>();
+        groupedObjects.ForEach([&dynamicTypes](const std::shared_ptr<DQueryInterface>& in_object) noexcept -> DQueryInterface::EPredicateResult
+        {
+            if (dynamicTypes.empty() || (dynamicTypes.back() != in_object->GetDynamicType()))
+                dynamicTypes.push_back(in_object->GetDynamicType());
+            return DQueryInterface::EPredicateResult::Ok;
+        });
+        assert(dynamicTypes.size() == 2);
+    }
+
+    {// Parallel iteration visits every object, stops early when cancelled, and runs nested jobs inline.
+        auto executor  = DThreadPoolExecutor(3);
+        auto fooCount  = std::atomic<size_t>(0);
+        objectsImplementingBar.ForEachParallel(executor, [&fooCount](const std::shared_ptr<DQueryInterface>& in_object) noexcept -> DQueryInterface::EPredicateResult
+        {
+            fooCount.fetch_add(in_object->HasInterface<DFooInterface>() ? 1 : 0, std::memory_order_relaxed);
+            return DQueryInterface::EPredicateResult::Ok;
+        }, 1);
+        assert(fooCount.load() == 2);
+
+        auto visitedCount = std::atomic<size_t>(0);
+        objectsImplementingBar.ForEachParallel(executor, [&visitedCount](DBarInterface&) noexcept -> DQueryInterface::EPredicateResult
+        {
+            visitedCount.fetch_add(1, std::memory_order_relaxed);
+            return DQueryInterface::EPredicateResult::CancellationRequested;
+        }, 1);
+        assert((visitedCount.load() >= 1) && (visitedCount.load() <= executor.GetConcurrency()));
+
+        auto nestedCount = std::atomic<size_t>(0);
+        executor.Execute(4, [&](size_t) noexcept { executor.Execute(3, [&nestedCount](size_t) noexcept { nestedCount.fetch_add(1, std::memory_order_relaxed); }); });
+        assert(nestedCount.load() == 12);
+    }
+
+    {// Bulk additions and RemoveIf() round trip: each commits its changes as a whole.
+        auto batch = std::vector<std::shared_ptr<DQueryInterface>>{ std::make_shared<DExampleClass>(), std::make_shared<DOtherExampleClass>(), std::make_shared<DOtherExampleClass>() };
+        objectRegistry.RequestAddObjects(batch);
+        [[maybe_unused]] const auto addedCount = countObjects(objectsImplementingBar);
+        [[maybe_unused]] const auto removedCount = objectRegistry.RemoveIf([&batch](const std::shared_ptr<DQueryInterface>& in_object) noexcept
+        {
+            return std::find(batch.begin(), batch.end(), in_object) != batch.end();
+        });
+        assert((addedCount == 7) && (removedCount == 3) && (countObjects(objectsImplementingFoo) == 2) && (countObjects(objectsImplementingBar) == 4));
+    }
+
+    {// Emplaced objects come from a pool per class: a removed object's block serves the next one.
+        auto emplaced = objectRegistry.Emplace<DOtherExampleClass>();
+        [[maybe_unused]] const auto* emplacedAddress = emplaced.get();
+        objectRegistry.Commit();
+        objectRegistry.RequestRemoveObject(emplaced, nullptr);
+        countObjects(objectsImplementingFoo); // Collections drop their references as they catch up.
+        countObjects(objectsImplementingBar);
+        countObjects(objectsImplementingBaz);
+        emplaced.reset();
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE)
+        objectRegistry.ReleaseDeferredObjects();
+#endif
+        emplaced = objectRegistry.Emplace<DOtherExampleClass>();
+        assert(emplaced.get() == emplacedAddress);
+        objectRegistry.RequestRemoveObject(emplaced, nullptr);
+        objectRegistry.Commit();
+    }
+
+#if defined(DQUERYINTERFACE_USE_OBJECT_HANDLES)
+    {// Handles stop resolving once their object is removed. Nested iterations and lookups share the registry lock.
+        const auto obj3Handle = objectRegistry.GetObjectHandle(obj3.get());
+        assert(objectRegistry.ResolveObject(obj3Handle) == obj3);
+        objectsImplementingFoo.ForEach([&](DFooInterface&) noexcept -> DQueryInterface::EPredicateResult
+        {
+            assert(countObjects(objectsImplementingBar) == 4);
+            assert(objectRegistry.ResolveObject(obj3Handle) == obj3);
+            return DQueryInterface::EPredicateResult::Ok;
+        });
+        objectRegistry.RequestRemoveObject(obj3Handle);
+        objectRegistry.Commit();
+        assert(!objectRegistry.ResolveObject(obj3Handle) && (countObjects(objectsImplementingFoo) == 1));
+        objectRegistry.RequestAddObject(obj3);
+        objectRegistry.Commit();
+        assert(!objectRegistry.ResolveObject(obj3Handle) && objectRegistry.GetObjectHandle(obj3.get()));
+    }
+#endif
+
+#if defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    {// Objects leave the registry with their last strong reference. RemoveIf() purges them without counting them.
+        auto transient = std::make_shared<DOtherExampleClass>();
+        objectRegistry.RequestAddObject(transient);
+        assert(countObjects(objectsImplementingFoo) == 3);
+        transient.reset();
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE)
+        objectRegistry.ReleaseDeferredObjects(); // Drops the references taken by the iteration above.
+#endif
+        [[maybe_unused]] const auto removedCount = objectRegistry.RemoveIf([](const std::shared_ptr<DQueryInterface>&) noexcept { return false; });
+        assert((removedCount == 0) && (countObjects(objectsImplementingFoo) == 2));
+    }
+#endif
+
+#if defined(DQUERYINTERFACE_USE_DEFERRED_RELEASE) && !defined(DQUERYINTERFACE_USE_WEAK_REFERENCES)
+    {// Removed objects outlive their commit until the references dropped by the registry are released.
+        auto transient = std::make_shared<DOtherExampleClass>();
+        auto transientRef = std::weak_ptr<DOtherExampleClass>(transient);
+        objectRegistry.RequestAddObject(transient);
+        objectRegistry.Commit();
+        objectRegistry.RequestRemoveObject(std::move(transient), nullptr);
+        assert(countObjects(objectsImplementingFoo) == 2);
+        assert(!transientRef.expired());
+        objectRegistry.ReleaseDeferredObjects();
+        assert(transientRef.expired());
+    }
+#endif
+
     return EXIT_SUCCESS;
 }